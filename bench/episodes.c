@@ -0,0 +1,157 @@
+/*
+ * tvi - TV series Information
+ *
+ * Copyright (C) 2014  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks that an episodes page cut short by its page matcher, the way
+   fetch_write_cb() stops a transfer, reads the same as the whole page
+   (which is all the page cache is ever given). The page is fed in chunks
+   of several sizes, down to a byte at a time, so the transfer stops at
+   the earliest point it could.
+
+   Usage: episodes PAGE */
+
+#define main tvi_main
+#include "main.c"
+#undef main
+
+#define EPISODES_LIST_MAX 1024
+
+struct episodes_reading
+{
+  size_t n_page;
+  int total_seasons;
+  int episodes[EPISODES_LIST_MAX];
+  char title[TVI_BUFMAX];
+  char description[TVI_BUFMAX];
+  char schedule[TVI_BUFMAX];
+};
+
+static bool
+read_page (struct tvi_buffer *b, const char *path)
+{
+  size_t n;
+  char buf[BUFSIZ];
+  FILE *fp;
+
+  fp = fopen (path, "rb");
+  if (!fp)
+    return false;
+  while ((n = fread (buf, 1, sizeof (buf), fp)) > 0)
+    tvi_buffer_append (b, buf, n);
+  fclose (fp);
+  return b->n > 0;
+}
+
+static void
+read_episodes (struct episodes_reading *r, const char *data, size_t n)
+{
+  int i;
+
+  init_series ();
+  buffer_put (&page);
+  tvi_buffer_append (&page, data, n);
+  parse_episodes_page ();
+
+  memset (r, 0, sizeof (*r));
+  r->n_page = n;
+  r->total_seasons = series.total_seasons;
+  for (i = 0; i < series.total_seasons && i < EPISODES_LIST_MAX; ++i)
+    r->episodes[i] = series.listing[i].episodes;
+  snprintf (r->title, TVI_BUFMAX, "%s", series.title.proper.s);
+  snprintf (r->description, TVI_BUFMAX, "%s", series.description);
+  snprintf (r->schedule, TVI_BUFMAX, "%s|%s|%s|%i",
+            series.schedule.day.s, series.schedule.time.s,
+            series.schedule.network.s, series.schedule.ended);
+  tvi_arena_free (&series.strings);
+}
+
+/* Returns how much of the N bytes of DATA a transfer getting them CHUNK
+   at a time would have read before its matcher had everything. */
+static size_t
+cut_episodes (const char *data, size_t n, size_t chunk)
+{
+  size_t k;
+  struct page_matcher m;
+  struct tvi_buffer b = TVI_BUFFER_INIT;
+
+  init_page_matcher (&m, PAGE_EPISODES);
+  for (k = 0; k < n; )
+  {
+    tvi_buffer_append (&b, data + k, (n - k < chunk) ? n - k : chunk);
+    k = b.n;
+    if (page_matcher_done (&m, &b))
+      break;
+  }
+  tvi_buffer_free (&b);
+  return k;
+}
+
+static bool
+same_episodes (const struct episodes_reading *a,
+               const struct episodes_reading *b)
+{
+  int i;
+
+  if (a->total_seasons != b->total_seasons ||
+      strcmp (a->title, b->title) != 0 ||
+      strcmp (a->description, b->description) != 0 ||
+      strcmp (a->schedule, b->schedule) != 0)
+    return false;
+  for (i = 0; i < a->total_seasons && i < EPISODES_LIST_MAX; ++i)
+    if (a->episodes[i] != b->episodes[i])
+      return false;
+  return true;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const size_t chunks[] = {1, 7, 13, 4096, 16384};
+  bool ok;
+  size_t i;
+  size_t n;
+  struct tvi_buffer data = TVI_BUFFER_INIT;
+  struct episodes_reading whole;
+  struct episodes_reading cut;
+
+  program_name = "episodes";
+  if (argc != 2 || !read_page (&data, argv[1]))
+  {
+    fprintf (stderr, "Usage: %s PAGE\n", program_name);
+    return E_OPTION;
+  }
+  set_pattern_sizes ();
+  init_scanners ();
+
+  read_episodes (&whole, data.buffer, data.n);
+  printf ("%zu bytes, %i seasons listed\n", data.n, whole.total_seasons);
+  ok = true;
+  for (i = 0; i < sizeof (chunks) / sizeof (*chunks); ++i)
+  {
+    n = cut_episodes (data.buffer, data.n, chunks[i]);
+    read_episodes (&cut, data.buffer, n);
+    printf ("%6zu-byte chunks: stopped after %zu bytes, %s\n",
+            chunks[i], n, same_episodes (&whole, &cut) ? "same" : "DIFFERENT");
+    if (!same_episodes (&whole, &cut))
+      ok = false;
+  }
+
+  tvi_buffer_free (&data);
+  free_scanners ();
+  return ok ? E_OKAY : E_SYSTEM;
+}
@@ -0,0 +1,493 @@
+/*
+ * tvi - TV series Information
+ *
+ * Copyright (C) 2014  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks that the season parser reads a season page the same whether it
+   is fed the page in chunks as it downloads (of 1, 7, 13, 4096 and 16384
+   bytes) or all at once as it comes from the cache, then times both
+   against the whole-page parser tvi used to have.
+
+   Usage: season PAGE [ITERATIONS] */
+
+#define _GNU_SOURCE
+#define main tvi_main
+#include "main.c"
+#undef main
+
+#define SEASON_ITERATIONS 300
+#define SEASON_WHOLE      0 /* chunk size that stands for the whole page */
+
+#define OLD_EPISODE_PATTERN "Episode %u\r\n"
+
+/* The season page parser from before pages were parsed as they download,
+   kept to time the new one against. Every episode is found by searching
+   the whole page for its marker, and each of its fields by searching on
+   from there. */
+struct old_episode
+{
+  bool has_aired;
+  double rating;
+  char title[TVI_BUFMAX];
+  char air[TVI_BUFMAX];
+  char *description;
+};
+
+static const struct
+{
+  char c;
+  size_t n1;
+  size_t n2;
+  const char *s1;
+  const char *s2;
+}
+old_entity_ref[] =
+{
+  {'"', 6, 5, "&quot;", "&#34;"},
+  {'&', 5, 5, "&amp;", "&#38;"},
+  {'\'', 6, 5, "&apos;", "&#39;"},
+  {'<', 4, 5, "&lt;", "&#60;"},
+  {'>', 4, 5, "&gt;", "&#62;"},
+  {' ', 6, 6, "&nbsp;", "&#160;"},
+  {'\0', 0, 0, NULL, NULL}
+};
+
+static bool
+old_is_entity_ref (const char *s)
+{
+  size_t i;
+
+  for (i = 0; old_entity_ref[i].c; ++i)
+    if (tvi_strncasecmp (s, old_entity_ref[i].s1, old_entity_ref[i].n1) == 0 ||
+        memcmp (s, old_entity_ref[i].s2, old_entity_ref[i].n2) == 0)
+      return true;
+  return false;
+}
+
+static char
+old_entity_ref_char (const char **s)
+{
+  size_t i;
+  size_t n = 0;
+
+  for (i = 0; old_entity_ref[i].c; ++i)
+  {
+    if (tvi_strncasecmp (*s, old_entity_ref[i].s1, old_entity_ref[i].n1) == 0)
+      n = old_entity_ref[i].n1;
+    else if (memcmp (*s, old_entity_ref[i].s2, old_entity_ref[i].n2) == 0)
+      n = old_entity_ref[i].n2;
+    if (n != 0)
+    {
+      *s += n;
+      return old_entity_ref[i].c;
+    }
+  }
+  return '&';
+}
+
+static void
+old_parse_title (struct old_episode *episode, const char *page, const char *p)
+{
+  ssize_t i;
+  char *t;
+  const char *q;
+
+  for (i = p - page; i >= 0; --i)
+  {
+    if (page[i] == '<' && page[i + 1] == '/' &&
+        page[i + 2] == 'a' && page[i + 3] == '>')
+    {
+      for (i--; page[i] != '>'; --i)
+        ;
+      for (t = episode->title, q = page + (i + 1); *q != '<'; ++t, ++q)
+        *t = *q;
+      *t = '\0';
+      break;
+    }
+  }
+}
+
+static void
+old_parse_air (struct old_episode *episode, const char *p)
+{
+  char *a;
+
+  p = strstr (p, EPISODE_AIR_PATTERN);
+  if (p && *p)
+  {
+    p += n_episode_air_pattern;
+    for (a = episode->air; *p != '<'; ++a, ++p)
+      *a = *p;
+    *a = '\0';
+  }
+}
+
+static void
+old_parse_rating (struct old_episode *episode, const char *p)
+{
+  char buffer[TVI_BUFMAX];
+  char *r;
+
+  buffer[0] = '\0';
+  p = strstr (p, EPISODE_RATING_PATTERN);
+  if (p && *p)
+  {
+    p += n_episode_rating_pattern;
+    for (; *p != '>'; ++p)
+      ;
+    for (p++, r = buffer; *p != '<'; ++r, ++p)
+      *r = *p;
+    *r = '\0';
+  }
+  if (*buffer)
+    episode->rating = strtod (buffer, (char **) NULL);
+}
+
+/* Skips the tags and white space the description starts with. */
+static const char *
+old_description_start (const char *p)
+{
+  for (;;)
+  {
+    if (*p == '<' || *p == '>' || isspace ((unsigned char) *p))
+    {
+      if (*p == '<')
+        while (*p != '>')
+          p++;
+      else
+        p++;
+      continue;
+    }
+    return p;
+  }
+}
+
+/* The description is walked twice, once to size it and once to copy it. */
+static void
+old_parse_description (struct old_episode *episode, const char *start)
+{
+  bool end;
+  size_t n;
+  char *d;
+  const char *p;
+
+  n = 0;
+  p = strstr (start, EPISODE_DESCRIPTION_PATTERN);
+  if (p && *p)
+  {
+    p += n_episode_description_pattern;
+    if (*p == '<' && *(p + 1) == '/')
+    {
+      episode->description = tvi_strdup (EMPTY_DESCRIPTION, -1);
+      return;
+    }
+    for (p = old_description_start (p); *p; ++p, ++n)
+    {
+      end = false;
+      while (*p == '<')
+      {
+        if (*(p + 1) == '/')
+        {
+          end = true;
+          break;
+        }
+        while (*p != '>')
+          p++;
+        if (*p == '>')
+          p++;
+      }
+      if (end)
+        break;
+    }
+  }
+
+  episode->description = tvi_newa (char, n + 1);
+  *episode->description = '\0';
+  p = strstr (start, EPISODE_DESCRIPTION_PATTERN);
+  if (p && *p)
+  {
+    p = old_description_start (p + n_episode_description_pattern);
+    for (d = episode->description; *p; ++d, ++p)
+    {
+      end = false;
+      while (*p == '<')
+      {
+        if (*(p + 1) == '/')
+        {
+          end = true;
+          break;
+        }
+        while (*p != '>')
+          p++;
+        if (*p == '>')
+          p++;
+      }
+      if (end)
+        break;
+      while (old_is_entity_ref (p))
+        *d++ = old_entity_ref_char (&p);
+      *d = *p;
+    }
+    *d = '\0';
+  }
+}
+
+static void
+old_set_has_aired (struct old_episode *episode)
+{
+  size_t n;
+  time_t a;
+  char buffer[TVI_BUFMAX];
+  struct tm tm;
+  const char *t;
+
+  n = strlen (episode->air);
+  memcpy (buffer, episode->air, n + 1);
+  t = series.schedule.time.s;
+  if (*t && strchr (t, ':') && n + strlen (t) < TVI_BUFMAX)
+    memcpy (buffer + n, t, strlen (t) + 1);
+
+  memset (&tm, 0, sizeof (struct tm));
+  strptime (buffer, "%m/%d/%y %I:%M %p", &tm);
+  a = mktime (&tm);
+  if (a != -1 && a < time (NULL))
+    episode->has_aired = true;
+  if (!episode->has_aired)
+    episode->rating = -1.0f;
+}
+
+/* Parses the whole PAGE into EPISODES (TVI_BUFMAX of them) and returns how
+   many there are. */
+static int
+old_parse_season (struct old_episode *episodes, const char *page)
+{
+  int i;
+  char marker[TVI_BUFMAX];
+  const char *p;
+  struct old_episode *episode;
+
+  for (i = 0; i < TVI_BUFMAX; ++i)
+  {
+    snprintf (marker, TVI_BUFMAX, OLD_EPISODE_PATTERN, i + 1);
+    p = strstr (page, marker);
+    if (!p)
+      break;
+    episode = &episodes[i];
+    episode->has_aired = false;
+    episode->rating = 0.0f;
+    *episode->title = '\0';
+    *episode->air = '\0';
+    old_parse_title (episode, page, p);
+    old_parse_air (episode, p);
+    old_set_has_aired (episode);
+    old_parse_rating (episode, p);
+    old_parse_description (episode, p);
+  }
+  return i;
+}
+
+static void
+old_free_season (struct old_episode *episodes, int total_episodes)
+{
+  int e;
+
+  for (e = 0; e < total_episodes; ++e)
+    tvi_free (episodes[e].description);
+}
+
+/* Returns the microseconds it takes the old parser to read the page. */
+static double
+time_old_season (struct old_episode *episodes,
+                 const struct tvi_buffer *data,
+                 int iterations,
+                 int *total_episodes)
+{
+  int i;
+  struct timespec a;
+  struct timespec b;
+
+  clock_gettime (CLOCK_MONOTONIC, &a);
+  for (i = 0; i < iterations; ++i)
+  {
+    *total_episodes = old_parse_season (episodes, data->buffer);
+    old_free_season (episodes, *total_episodes);
+  }
+  clock_gettime (CLOCK_MONOTONIC, &b);
+  return ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec)) / 1e3
+         / iterations;
+}
+
+static bool
+read_page (struct tvi_buffer *b, const char *path)
+{
+  size_t n;
+  char buf[BUFSIZ];
+  FILE *fp;
+
+  fp = fopen (path, "rb");
+  if (!fp)
+    return false;
+  while ((n = fread (buf, 1, sizeof (buf), fp)) > 0)
+    tvi_buffer_append (b, buf, n);
+  fclose (fp);
+  return b->n > 0;
+}
+
+/* Parses the N bytes of DATA into SEASON, fed CHUNK bytes at a time. */
+static void
+parse_season (struct season *season, const char *data, size_t n, size_t chunk)
+{
+  size_t k;
+  struct season_parser sp;
+  struct tvi_buffer whole = TVI_BUFFER_INIT;
+
+  season_parser_init (&sp, season, -1);
+  if (chunk == SEASON_WHOLE)
+  {
+    tvi_buffer_append (&whole, data, n);
+    season_parser_end (&sp, &whole);
+  }
+  else
+  {
+    for (k = 0; k < n; k += chunk)
+      season_parser_feed (&sp, data + k, (n - k < chunk) ? n - k : chunk);
+    season_parser_end (&sp, NULL);
+  }
+  pool_wait (&workers);
+  season_parser_free (&sp);
+  tvi_buffer_free (&whole);
+}
+
+/* Writes out everything the parser found in SEASON to R. */
+static void
+dump_season (struct tvi_buffer *r, const struct season *season)
+{
+  int e;
+  char line[TVI_BUFMAX];
+  const struct episode *episode;
+
+  tvi_buffer_clear (r);
+  for (e = 0; e < season->total_episodes; ++e)
+  {
+    episode = &season->episode[e];
+    snprintf (line, TVI_BUFMAX, "%i|%s|%s|%.2f|%i|%lli|",
+              e + 1, episode->title.s, episode->air.s, episode->rating,
+              episode->has_aired, (long long) episode->air_time);
+    tvi_buffer_append (r, line, strlen (line));
+    if (episode->description)
+      tvi_buffer_append (r, episode->description,
+                         strlen (episode->description));
+    tvi_buffer_append (r, "\n", 1);
+  }
+}
+
+static double
+time_season (const char *data, size_t n, size_t chunk, int iterations)
+{
+  int i;
+  struct season season;
+  struct timespec a;
+  struct timespec b;
+
+  clock_gettime (CLOCK_MONOTONIC, &a);
+  for (i = 0; i < iterations; ++i)
+  {
+    parse_season (&season, data, n, chunk);
+    tvi_arena_free (&series.strings);
+  }
+  clock_gettime (CLOCK_MONOTONIC, &b);
+  return ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec)) / 1e3
+         / iterations;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const size_t chunks[] = {1, 7, 13, 4096, 16384};
+  bool ok;
+  int iterations;
+  int old_episodes;
+  int total_episodes;
+  size_t i;
+  double chunk_time;
+  double old_time;
+  double whole_time;
+  struct old_episode *old;
+  struct season season;
+  struct tvi_buffer data = TVI_BUFFER_INIT;
+  struct tvi_buffer whole = TVI_BUFFER_INIT;
+  struct tvi_buffer cut = TVI_BUFFER_INIT;
+
+  program_name = "season";
+  if (argc < 2 || !read_page (&data, argv[1]))
+  {
+    fprintf (stderr, "Usage: %s PAGE [ITERATIONS]\n", program_name);
+    return E_OPTION;
+  }
+  iterations = (argc > 2) ? atoi (argv[2]) : SEASON_ITERATIONS;
+  if (iterations < 1)
+    iterations = 1;
+  set_pattern_sizes ();
+  init_scanners ();
+  init_series ();
+  init_air_clock ();
+  pool_init (&workers, 0);
+  series.season = &season;
+  series.total_seasons = 1;
+
+  parse_season (&season, data.buffer, data.n, SEASON_WHOLE);
+  dump_season (&whole, &season);
+  total_episodes = season.total_episodes;
+  tvi_arena_free (&series.strings);
+  printf ("%zu bytes, %i episodes\n", data.n, total_episodes);
+
+  ok = total_episodes > 0;
+  for (i = 0; i < sizeof (chunks) / sizeof (*chunks); ++i)
+  {
+    parse_season (&season, data.buffer, data.n, chunks[i]);
+    dump_season (&cut, &season);
+    tvi_arena_free (&series.strings);
+    printf ("%6zu-byte chunks: %s\n", chunks[i],
+            (cut.n == whole.n && memcmp (cut.buffer, whole.buffer, cut.n) == 0)
+            ? "same" : "DIFFERENT");
+    if (cut.n != whole.n || memcmp (cut.buffer, whole.buffer, cut.n) != 0)
+      ok = false;
+  }
+
+  old = tvi_newa (struct old_episode, TVI_BUFMAX);
+  old_time = time_old_season (old, &data, iterations, &old_episodes);
+  tvi_free (old);
+  if (old_episodes != total_episodes)
+  {
+    printf ("old parser found %i episodes\n", old_episodes);
+    ok = false;
+  }
+  whole_time = time_season (data.buffer, data.n, SEASON_WHOLE, iterations);
+  chunk_time = time_season (data.buffer, data.n, 16384, iterations);
+  printf ("old whole-page parser: %8.1f us per page\n", old_time);
+  printf ("whole page:            %8.1f us per page (%.1fx)\n",
+          whole_time, old_time / whole_time);
+  printf ("16384-byte chunks:     %8.1f us per page (%.1fx)\n",
+          chunk_time, old_time / chunk_time);
+
+  tvi_buffer_free (&cut);
+  tvi_buffer_free (&whole);
+  tvi_buffer_free (&data);
+  pool_free (&workers);
+  free_scanners ();
+  return ok ? E_OKAY : E_SYSTEM;
+}
@@ -0,0 +1,229 @@
+/*
+ * tvi - TV series Information
+ *
+ * Copyright (C) 2014  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks every way tvi_strcasestr() can search (the scalar Two-Way
+   search, and the SSE2 and AVX2 block searches where the processor has
+   them) against the strcasestr() of the C library on random haystacks
+   and needles, then times them all on text like that of the pages.
+
+   Usage: strcasestr [CASES] */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "utils.c"
+
+#define STRCASESTR_CASES    2000000L
+#define STRCASESTR_HAYSTACK 300
+#define STRCASESTR_NEEDLE   70  /* past SIMD_NEEDLE_MAX and the Two-Way
+                                   long needle threshold */
+#define STRCASESTR_REPORT   20  /* mismatches printed at most */
+
+const char *program_name = "strcasestr";
+
+/* letters on both sides of the case gap, the bytes next to it and two
+   that only a locale would fold */
+static const char alphabet[] = "aAbBzZ@[`{ 0\xc9\xe9";
+
+enum
+{
+  WAY_SCALAR,
+  WAY_SSE2,
+  WAY_AVX2,
+  WAY_LIBC,
+  WAYS
+};
+
+static const char *const way_names[WAYS] = {"scalar", "sse2", "avx2", "libc"};
+
+static bool have_way[WAYS];
+
+static char *
+search_way (int way, const char *haystack, const char *needle)
+{
+  switch (way)
+  {
+#ifdef HAVE_SIMD_STRCASESTR
+    case WAY_SSE2:
+      if (*needle && strlen (needle) <= SIMD_NEEDLE_MAX)
+        return strcasestr_simd (haystack, needle, search_sse2);
+      break;
+    case WAY_AVX2:
+      if (*needle && strlen (needle) <= SIMD_NEEDLE_MAX)
+        return strcasestr_simd (haystack, needle, search_avx2);
+      break;
+#endif
+    case WAY_LIBC:
+      return strcasestr (haystack, needle);
+  }
+  return strcasestr_scalar (haystack, needle);
+}
+
+static char
+random_char (void)
+{
+  return alphabet[rand () % (sizeof (alphabet) - 1)];
+}
+
+/* Makes up a needle, half of the time out of the haystack H (of length
+   N) with the case of some of its letters flipped. */
+static void
+random_needle (char *needle, size_t m, const char *h, size_t n)
+{
+  size_t i;
+  size_t start;
+
+  if (m > 0 && n > 0 && rand () % 2)
+  {
+    start = rand () % n;
+    for (i = 0; i < m && start + i < n; ++i)
+    {
+      needle[i] = h[start + i];
+      if (isalpha ((unsigned char) needle[i]) && rand () % 2)
+        needle[i] ^= 0x20;
+    }
+    needle[i] = '\0';
+    return;
+  }
+  for (i = 0; i < m; ++i)
+    needle[i] = random_char ();
+  needle[m] = '\0';
+}
+
+static long
+check_ways (long cases)
+{
+  int w;
+  long bad;
+  long c;
+  size_t i;
+  size_t m;
+  size_t n;
+  char haystack[STRCASESTR_HAYSTACK + 1];
+  char needle[STRCASESTR_NEEDLE + 1];
+  char *want;
+  char *got;
+
+  srand (1);
+  bad = 0;
+  for (c = 0; c < cases; ++c)
+  {
+    n = rand () % STRCASESTR_HAYSTACK;
+    for (i = 0; i < n; ++i)
+      haystack[i] = random_char ();
+    haystack[n] = '\0';
+    m = rand () % ((c % 7 == 0) ? STRCASESTR_NEEDLE : 6);
+    random_needle (needle, m, haystack, n);
+
+    want = strcasestr (haystack, needle);
+    for (w = 0; w < WAY_LIBC; ++w)
+    {
+      if (!have_way[w])
+        continue;
+      got = search_way (w, haystack, needle);
+      if (got == want)
+        continue;
+      if (bad++ < STRCASESTR_REPORT)
+        printf ("%s: \"%s\" in \"%s\" at %li, not %li\n", way_names[w],
+                needle, haystack, got ? (long) (got - haystack) : -1L,
+                want ? (long) (want - haystack) : -1L);
+    }
+  }
+  return bad;
+}
+
+static double
+now_ns (void)
+{
+  struct timespec t;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void
+time_ways (void)
+{
+  static const struct
+  {
+    const char *name;
+    size_t n;
+    const char *needle;
+  }
+  runs[] =
+  {
+    {"cast name (24 B), miss", 24, "lannister"},
+    {"role (40 B), miss", 40, "director"},
+    {"4 KiB text, miss", 4096, "lannister"},
+    {"64 KiB text, miss", 65536, "lannister"},
+  };
+  static const char text[] = "abcdefghijk LMNOP qrstuvwxyz";
+  static char h[65536 + 1];
+  volatile long sink;
+  int w;
+  long i;
+  long iterations;
+  size_t j;
+  size_t r;
+  double t;
+
+  sink = 0;
+  for (r = 0; r < sizeof (runs) / sizeof (*runs); ++r)
+  {
+    for (j = 0; j < runs[r].n; ++j)
+      h[j] = text[(j * 7) % (sizeof (text) - 1)];
+    h[runs[r].n] = '\0';
+    iterations = 200000000L / (long) (runs[r].n + 50);
+    printf ("%-24s", runs[r].name);
+    for (w = 0; w < WAYS; ++w)
+    {
+      if (!have_way[w])
+        continue;
+      t = now_ns ();
+      for (i = 0; i < iterations; ++i)
+        sink += (long) search_way (w, h, runs[r].needle);
+      printf ("  %s %8.1f ns", way_names[w], (now_ns () - t) / iterations);
+    }
+    fputc ('\n', stdout);
+  }
+}
+
+int
+main (int argc, char **argv)
+{
+  long bad;
+  long cases;
+
+  cases = (argc > 1) ? atol (argv[1]) : STRCASESTR_CASES;
+  have_way[WAY_SCALAR] = true;
+  have_way[WAY_LIBC] = true;
+#ifdef HAVE_SIMD_STRCASESTR
+  __builtin_cpu_init ();
+  have_way[WAY_SSE2] = true;
+  have_way[WAY_AVX2] = __builtin_cpu_supports ("avx2") != 0;
+#endif
+
+  bad = check_ways (cases);
+  printf ("%li cases, %li mismatches\n", cases, bad);
+  time_ways ();
+  return (bad == 0) ? E_OKAY : E_SYSTEM;
+}
@@ -0,0 +1,459 @@
+/*
+ * tvi - TV series Information
+ *
+ * Copyright (C) 2014  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "cache.h"
+#include "utils.h"
+
+#define CACHE_NAME       PROGRAM_NAME
+#define CACHE_HOME       ".cache"
+#define CACHE_PAGES_DIR  "pages"
+#define CACHE_MAGIC      "tvi-page-cache 2"
+#define CACHE_MAP_MAGIC  "tvi-map 1"
+#define CACHE_KEY_SIZE   17 /* 16 hex digits + '\0' */
+
+#define FNV_OFFSET_BASIS UINT64_C (0xcbf29ce484222325)
+#define FNV_PRIME        UINT64_C (0x100000001b3)
+
+extern const char *program_name;
+
+static char *root_path = NULL;
+static char *pages_path = NULL;
+
+static char *
+path_join (const char *dir, const char *name)
+{
+  size_t n_dir;
+  size_t n_name;
+  char *p;
+
+  n_dir = strlen (dir);
+  n_name = strlen (name);
+  p = tvi_newa (char, n_dir + n_name + 2);
+  memcpy (p, dir, n_dir);
+  p[n_dir] = '/';
+  memcpy (p + n_dir + 1, name, n_name + 1);
+  return p;
+}
+
+/* same as `mkdir -p PATH' */
+static bool
+make_dirs (char *path)
+{
+  char *p;
+
+  for (p = path + 1; *p; ++p)
+  {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    if (mkdir (path, 0700) == -1 && errno != EEXIST)
+    {
+      *p = '/';
+      return false;
+    }
+    *p = '/';
+  }
+  return mkdir (path, 0700) == 0 || errno == EEXIST;
+}
+
+static void
+cache_key (const char *url, char *key)
+{
+  uint64_t h;
+  const unsigned char *p;
+
+  h = FNV_OFFSET_BASIS;
+  for (p = (const unsigned char *) url; *p; ++p)
+  {
+    h ^= *p;
+    h *= FNV_PRIME;
+  }
+  snprintf (key, CACHE_KEY_SIZE, "%016llx", (unsigned long long) h);
+}
+
+static char *
+entry_path (const char *url)
+{
+  char key[CACHE_KEY_SIZE];
+
+  cache_key (url, key);
+  return path_join (pages_path, key);
+}
+
+bool
+cache_init (const char *dir)
+{
+  const char *home;
+
+  if (dir && *dir)
+    root_path = tvi_strdup (dir, -1);
+  else
+  {
+    home = getenv ("XDG_CACHE_HOME");
+    if (home && *home == '/')
+      root_path = path_join (home, CACHE_NAME);
+    else
+    {
+      home = getenv ("HOME");
+      if (!home || !*home)
+      {
+        tvi_debug ("no cache directory available");
+        return false;
+      }
+      char *base = path_join (home, CACHE_HOME);
+      root_path = path_join (base, CACHE_NAME);
+      tvi_free (base);
+    }
+  }
+
+  pages_path = path_join (root_path, CACHE_PAGES_DIR);
+  if (!make_dirs (pages_path))
+  {
+    tvi_error (errno, "failed to create cache directory `%s'", pages_path);
+    cache_cleanup ();
+    return false;
+  }
+
+  tvi_debug ("using cache directory \"%s\"", root_path);
+  return true;
+}
+
+void
+cache_cleanup (void)
+{
+  tvi_free (root_path);
+  tvi_free (pages_path);
+}
+
+/* Returns the path of file NAME in directory SUBDIR of the cache (which is
+   created if needed), or NULL if there is no cache directory. */
+char *
+cache_path (const char *subdir, const char *name)
+{
+  char *dir;
+  char *path;
+
+  if (!root_path)
+    return NULL;
+
+  dir = path_join (root_path, subdir);
+  if (!make_dirs (dir))
+  {
+    tvi_debug ("failed to create \"%s\"", dir);
+    tvi_free (dir);
+    return NULL;
+  }
+
+  path = path_join (dir, name);
+  tvi_free (dir);
+  return path;
+}
+
+/* Entries are a short text header followed by the raw page body. The
+   header is made of four lines: a magic line, the URL the page was
+   downloaded from, and the ETag and Last-Modified validators sent along
+   with it (either of which may be empty). The age of an entry is taken
+   from the modification time of the file. */
+static bool
+parse_header_line (char **p, char *end, char *value, size_t n_value)
+{
+  size_t n;
+  char *eol;
+
+  eol = memchr (*p, '\n', end - *p);
+  if (!eol)
+    return false;
+  n = eol - *p;
+  if (value)
+  {
+    if (n >= n_value)
+      return false;
+    memcpy (value, *p, n);
+    value[n] = '\0';
+  }
+  *p = eol + 1;
+  return true;
+}
+
+int
+cache_load (const char *url,
+            time_t ttl,
+            char **buffer,
+            size_t *n,
+            struct cache_validators *v)
+{
+  int result;
+  size_t n_data;
+  char *data;
+  char *end;
+  char *p;
+  char *path;
+  FILE *fp;
+  struct stat st;
+  char magic[TVI_BUFMAX];
+  char u[TVI_BUFMAX];
+
+  if (!pages_path)
+    return CACHE_MISS;
+
+  path = entry_path (url);
+  fp = fopen (path, "rb");
+  tvi_free (path);
+  if (!fp)
+    return CACHE_MISS;
+
+  if (fstat (fileno (fp), &st) == -1)
+  {
+    fclose (fp);
+    return CACHE_MISS;
+  }
+
+  n_data = st.st_size;
+  data = tvi_newa (char, n_data + 1);
+  if (fread (data, 1, n_data, fp) != n_data)
+  {
+    fclose (fp);
+    tvi_free (data);
+    return CACHE_MISS;
+  }
+  fclose (fp);
+  data[n_data] = '\0';
+
+  p = data;
+  end = data + n_data;
+  if (!parse_header_line (&p, end, magic, TVI_BUFMAX) ||
+      strcmp (magic, CACHE_MAGIC) != 0 ||
+      !parse_header_line (&p, end, u, TVI_BUFMAX) ||
+      strcmp (u, url) != 0 ||
+      !parse_header_line (&p, end, v->etag, TVI_BUFMAX) ||
+      !parse_header_line (&p, end, v->last_modified, TVI_BUFMAX))
+  {
+    tvi_debug ("cache entry for \"%s\" is invalid", url);
+    tvi_free (data);
+    return CACHE_MISS;
+  }
+
+  if (time (NULL) - st.st_mtime >= ttl)
+  {
+    if (!*v->etag && !*v->last_modified)
+    {
+      tvi_debug ("cache entry for \"%s\" is stale", url);
+      tvi_free (data);
+      return CACHE_MISS;
+    }
+    tvi_debug ("cache entry for \"%s\" needs revalidation", url);
+    result = CACHE_STALE;
+  }
+  else
+    result = CACHE_FRESH;
+
+  *n = end - p;
+  memmove (data, p, *n + 1);
+  *buffer = data;
+  tvi_debug ("loaded \"%s\" from cache (%zu bytes)", url, *n);
+  return result;
+}
+
+void
+cache_store (const char *url,
+             const char *buffer,
+             size_t n,
+             const struct cache_validators *v)
+{
+  bool ok;
+  char *path;
+  char *tmp;
+  FILE *fp;
+
+  if (!pages_path)
+    return;
+
+  path = entry_path (url);
+  tmp = tvi_newa (char, strlen (path) + 32);
+  snprintf (tmp, strlen (path) + 32, "%s.%li", path, (long) getpid ());
+
+  fp = fopen (tmp, "wb");
+  if (!fp)
+  {
+    tvi_debug ("failed to open \"%s\" for writing", tmp);
+    tvi_free (tmp);
+    tvi_free (path);
+    return;
+  }
+
+  ok = fprintf (fp, CACHE_MAGIC "\n%s\n%s\n%s\n",
+                url, v->etag, v->last_modified) > 0 &&
+       fwrite (buffer, 1, n, fp) == n;
+  ok = (fclose (fp) == 0) && ok;
+
+  /* rename(2) makes sure readers never see a half written entry */
+  if (!ok || rename (tmp, path) == -1)
+  {
+    tvi_debug ("failed to write cache entry for \"%s\"", url);
+    unlink (tmp);
+  }
+
+  tvi_free (tmp);
+  tvi_free (path);
+}
+
+/* Restarts the TTL of a cache entry the server said is unchanged. */
+void
+cache_touch (const char *url)
+{
+  char *path;
+
+  if (!pages_path)
+    return;
+
+  path = entry_path (url);
+  if (utime (path, NULL) == -1)
+    tvi_debug ("failed to update cache entry for \"%s\"", url);
+  tvi_free (path);
+}
+
+/* Maps are small text files in the cache directory holding one
+   "KEY\tVALUE" line per entry after a magic line. Keys and values can not
+   contain tabs or newlines. */
+static FILE *
+open_map (const char *map, const char *mode, char **path)
+{
+  char line[TVI_BUFMAX];
+  FILE *fp;
+
+  *path = path_join (root_path, map);
+  fp = fopen (*path, mode);
+  if (!fp || *mode == 'w')
+    return fp;
+  if (!fgets (line, TVI_BUFMAX, fp) ||
+      strcmp (line, CACHE_MAP_MAGIC "\n") != 0)
+  {
+    tvi_debug ("map \"%s\" is invalid", *path);
+    fclose (fp);
+    return NULL;
+  }
+  return fp;
+}
+
+/* Splits LINE into key and value. Returns the value, or NULL if LINE is
+   not an entry. */
+static char *
+split_map_line (char *line)
+{
+  char *v;
+
+  v = strchr (line, '\t');
+  if (!v)
+    return NULL;
+  *v++ = '\0';
+  v[strcspn (v, "\n")] = '\0';
+  return v;
+}
+
+/* Looks KEY up in MAP and copies its value to VALUE (of size N). */
+bool
+cache_map_get (const char *map, const char *key, char *value, size_t n)
+{
+  bool found;
+  char *path;
+  char *v;
+  char line[TVI_BUFMAX * 2];
+  FILE *fp;
+
+  if (!root_path)
+    return false;
+
+  found = false;
+  fp = open_map (map, "r", &path);
+  tvi_free (path);
+  if (!fp)
+    return false;
+
+  while (!found && fgets (line, sizeof (line), fp))
+  {
+    v = split_map_line (line);
+    if (v && strcmp (line, key) == 0 && strlen (v) < n)
+    {
+      memcpy (value, v, strlen (v) + 1);
+      found = true;
+    }
+  }
+  fclose (fp);
+  return found;
+}
+
+/* Sets KEY to VALUE in MAP, replacing any earlier value. */
+void
+cache_map_put (const char *map, const char *key, const char *value)
+{
+  bool ok;
+  char *path;
+  char *tmp;
+  char *v;
+  char line[TVI_BUFMAX * 2];
+  FILE *in;
+  FILE *out;
+
+  if (!root_path || strpbrk (key, "\t\n") || strpbrk (value, "\t\n"))
+    return;
+
+  in = open_map (map, "r", &path);
+  tmp = tvi_newa (char, strlen (path) + 32);
+  snprintf (tmp, strlen (path) + 32, "%s.%li", path, (long) getpid ());
+
+  out = fopen (tmp, "w");
+  if (!out)
+  {
+    tvi_debug ("failed to open \"%s\" for writing", tmp);
+    if (in)
+      fclose (in);
+    tvi_free (tmp);
+    tvi_free (path);
+    return;
+  }
+
+  ok = fprintf (out, CACHE_MAP_MAGIC "\n") > 0;
+  while (ok && in && fgets (line, sizeof (line), in))
+  {
+    v = split_map_line (line);
+    if (v && strcmp (line, key) != 0)
+      ok = fprintf (out, "%s\t%s\n", line, v) > 0;
+  }
+  if (in)
+    fclose (in);
+  ok = ok && fprintf (out, "%s\t%s\n", key, value) > 0;
+  ok = (fclose (out) == 0) && ok;
+
+  if (!ok || rename (tmp, path) == -1)
+  {
+    tvi_debug ("failed to update map \"%s\"", path);
+    unlink (tmp);
+  }
+
+  tvi_free (tmp);
+  tvi_free (path);
+}
@@ -0,0 +1,61 @@
+/*
+ * tvi - TV series Information
+ *
+ * Copyright (C) 2014  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TVI_CACHE_H__
+#define __TVI_CACHE_H__
+
+#include <stddef.h>
+#include <time.h>
+
+#include "tvi.h"
+#include "utils.h"
+
+/* results of cache_load() */
+enum
+{
+  CACHE_MISS,  /* nothing usable is cached */
+  CACHE_STALE, /* cached, but older than the TTL and must be revalidated */
+  CACHE_FRESH  /* cached and still within the TTL */
+};
+
+/* response headers that let a stale entry be revalidated with a
+   conditional request instead of downloading it again */
+struct cache_validators
+{
+  char etag[TVI_BUFMAX];
+  char last_modified[TVI_BUFMAX];
+};
+
+bool cache_init (const char *dir);
+void cache_cleanup (void);
+char *cache_path (const char *subdir, const char *name);
+int cache_load (const char *url,
+                time_t ttl,
+                char **buffer,
+                size_t *n,
+                struct cache_validators *v);
+void cache_store (const char *url,
+                  const char *buffer,
+                  size_t n,
+                  const struct cache_validators *v);
+void cache_touch (const char *url);
+bool cache_map_get (const char *map, const char *key, char *value, size_t n);
+void cache_map_put (const char *map, const char *key, const char *value);
+
+#endif /* __TVI_CACHE_H__ */
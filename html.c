@@ -0,0 +1,202 @@
+/*
+ * tvi - TV series Information
+ *
+ * Copyright (C) 2014  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <ctype.h>
+#include <string.h>
+
+#include "html.h"
+
+#define html_space(c) isspace ((unsigned char) (c))
+
+/* Returns where the tag or attribute name at P ends (END at the latest). */
+static const char *
+name_end (const char *p, const char *end)
+{
+  for (; p < end; ++p)
+    if (html_space (*p) || *p == '=' || *p == '>' || *p == '/')
+      break;
+  return p;
+}
+
+void
+html_init (struct html_tokenizer *t,
+           const char *p,
+           const char *end,
+           bool last,
+           bool in_tag)
+{
+  t->p = p;
+  t->end = end;
+  t->last = last;
+  t->in_tag = in_tag;
+}
+
+/* Reads the attribute at P of the tag T is in. Returns where it ends, or
+   NULL if the end of the text comes first. */
+static const char *
+html_attribute (struct html_tokenizer *t,
+                const char *p,
+                struct html_token *token)
+{
+  const char *q;
+  const char *v;
+
+  q = name_end (p, t->end);
+  token->name = p;
+  token->n_name = q - p;
+  token->value = q;
+  token->n_value = 0;
+  while (q < t->end && html_space (*q))
+    q++;
+  if (q == t->end)
+    return NULL;
+  if (*q != '=')
+    return q;
+
+  for (++q; q < t->end && html_space (*q); ++q)
+    ;
+  if (q == t->end)
+    return NULL;
+  if (*q == '"' || *q == '\'')
+  {
+    v = memchr (q + 1, *q, t->end - q - 1);
+    if (!v)
+      return NULL;
+    token->value = q + 1;
+    token->n_value = v - q - 1;
+    return v + 1;
+  }
+  for (v = q; v < t->end && !html_space (*v) && *v != '>'; ++v)
+    ;
+  if (v == t->end)
+    return NULL;
+  token->value = q;
+  token->n_value = v - q;
+  return v;
+}
+
+/* Finds the next token of the text T is going through and fills in TOKEN.
+   Returns what sort of token it is. HTML_MORE is returned (and T left
+   where the token starts) when a token runs into the end of the text and
+   more of it is still to come; text is only returned once the tag after
+   it has started. */
+int
+html_next (struct html_tokenizer *t, struct html_token *token)
+{
+  const char *p;
+  const char *q;
+
+  token->value = NULL;
+  token->n_value = 0;
+  p = t->p;
+  for (;;)
+  {
+    t->p = p;
+    if (t->in_tag)
+    {
+      while (p < t->end && (html_space (*p) || *p == '/'))
+        p++;
+      if (p == t->end)
+        break;
+      if (*p == '>')
+      {
+        t->in_tag = false;
+        p++;
+        continue;
+      }
+      if (*p == '=')
+      {
+        /* nothing sensible to make of it */
+        p++;
+        continue;
+      }
+      q = html_attribute (t, p, token);
+      if (!q)
+        break;
+      t->p = q;
+      return HTML_ATTRIBUTE;
+    }
+
+    if (p == t->end)
+      break;
+    if (*p == '<' && t->end - p < 2)
+      break;
+
+    if (*p == '<' && p[1] == '/')
+    {
+      q = memchr (p + 2, '>', t->end - p - 2);
+      if (!q)
+        break;
+      token->name = p + 2;
+      token->n_name = name_end (p + 2, q) - (p + 2);
+      t->p = q + 1;
+      return HTML_TAG_CLOSE;
+    }
+
+    if (*p == '<' && (p[1] == '!' || p[1] == '?'))
+    {
+      if (t->end - p < 4)
+        break;
+      if (memcmp (p, "<!--", 4) == 0)
+      {
+        /* a comment can have any '>' in it but "-->" */
+        for (q = p + 4; (q = memchr (q, '>', t->end - q)); ++q)
+          if (q - p >= 6 && q[-1] == '-' && q[-2] == '-')
+            break;
+      }
+      else
+        q = memchr (p, '>', t->end - p);
+      if (!q)
+        break;
+      p = q + 1;
+      continue;
+    }
+
+    if (*p == '<' && isalpha ((unsigned char) p[1]))
+    {
+      q = name_end (p + 1, t->end);
+      if (q == t->end)
+        break;
+      token->name = p + 1;
+      token->n_name = q - (p + 1);
+      t->in_tag = true;
+      t->p = q;
+      return HTML_TAG_OPEN;
+    }
+
+    /* text, which a '<' that starts no tag is a part of */
+    q = memchr (p + 1, '<', t->end - p - 1);
+    if (!q)
+    {
+      if (!t->last)
+        break;
+      q = t->end;
+    }
+    token->name = p;
+    token->n_name = q - p;
+    t->p = q;
+    return HTML_TEXT;
+  }
+
+  if (!t->last)
+    return HTML_MORE;
+  t->p = t->end;
+  return HTML_END;
+}
@@ -0,0 +1,67 @@
+/*
+ * tvi - TV series Information
+ *
+ * Copyright (C) 2014  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __TVI_HTML_H__
+#define __TVI_HTML_H__
+
+#include <stddef.h>
+
+#include "tvi.h"
+
+/* what html_next() found */
+enum
+{
+  HTML_END,       /* the end of the text */
+  HTML_MORE,      /* a token cut short by the end of the text so far */
+  HTML_TAG_OPEN,  /* "<NAME", followed by its attributes */
+  HTML_ATTRIBUTE, /* NAME="VALUE" of the tag last opened */
+  HTML_TAG_CLOSE, /* "</NAME>" */
+  HTML_TEXT       /* text between tags, as it is in the page */
+};
+
+/* Splits HTML into tokens without copying or allocating anything; every
+   token points into the text. Comments, doctypes and the like are passed
+   over. A tokenizer can be started in the middle of a tag (say, right
+   after a marker found in it), in which case what is left of the tag is
+   read as attributes. */
+struct html_tokenizer
+{
+  const char *p;   /* next byte to look at */
+  const char *end; /* of the text */
+  bool last;       /* nothing comes after END */
+  bool in_tag;     /* P is inside of a tag */
+};
+
+struct html_token
+{
+  const char *name;  /* of the tag or attribute, or the text */
+  size_t n_name;
+  const char *value; /* of an attribute */
+  size_t n_value;
+};
+
+void html_init (struct html_tokenizer *t,
+                const char *p,
+                const char *end,
+                bool last,
+                bool in_tag);
+int html_next (struct html_tokenizer *t, struct html_token *token);
+
+#endif /* __TVI_HTML_H__ */
@@ -17,14 +17,25 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <float.h>
+#include <ctype.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <wchar.h>
 
 #include <curl/curl.h>
 
 #include "tvi.h"
+#include "cache.h"
+#include "html.h"
+#include "pool.h"
+#include "scan.h"
 #include "utils.h"
 
 #define HELP_TEXT \
@@ -45,6 +56,8 @@
   "                            cast and crew members are printed.\n" \
   "  -d, --description         print description for each episode\n" \
   "  -H, --highest-rated       print highest rated episode of series\n" \
+  "  -jN, --jobs=N             download at most N season pages at once\n" \
+  "                            (default: " TVI_STRINGIFY (DEFAULT_JOBS) ")\n" \
   "  -l, --last                print most recently aired episode\n" \
   "  -L, --lowest-rated        print lowest rated episode of series\n" \
   "  -n, --next                print next episode scheduled to air\n" \
@@ -52,6 +65,26 @@
   "                            downloading data (useful for writing\n" \
   "                            output to a file)\n" \
   "  -r, --rating              print rating for each episode\n" \
+  "  -S, --stats               print network transfer statistics to\n" \
+  "                            standard error when finished\n" \
+  "      --cache-dir=DIR       keep downloaded pages in DIR (default:\n" \
+  "                            $XDG_CACHE_HOME/tvi or ~/.cache/tvi)\n" \
+  "      --cache-ttl=TYPE=N    keep cached TYPE pages for N seconds,\n" \
+  "                            where TYPE is one of \"search\",\n" \
+  "                            \"episodes\", \"season\" or \"cast\". N may\n" \
+  "                            end with `m', `h' or `d' for minutes, hours\n" \
+  "                            or days. For more than one TYPE, use a\n" \
+  "                            comma-separated list (e.g.\n" \
+  "                            \"season=1d,cast=7d\").\n" \
+  "      --no-cache            do not read or write the page cache\n" \
+  "      --refresh             download every page again, even if it is\n" \
+  "                            cached, and update the cache\n" \
+  "      --top=K               print the K highest rated episodes that\n" \
+  "                            have aired, and any tied with the last of\n" \
+  "                            them, of the series or of each season\n" \
+  "                            given with --season\n" \
+  "      --bottom=K            print the K lowest rated episodes, as\n" \
+  "                            with --top\n" \
   "  -h, --help                print this text and exit\n" \
   "  -v, --version             print version information and exit\n" \
   "Only 1 TITLE can be provided at a time.\n" \
@@ -71,6 +104,28 @@
 
 #define PROPELLER_SIZE 4
 
+#define HTTP_NOT_MODIFIED 304L
+
+#define HTTP_STATUS_PREFIX       "HTTP/"
+#define ETAG_HEADER              "ETag:"
+#define LAST_MODIFIED_HEADER     "Last-Modified:"
+#define IF_NONE_MATCH_HEADER     "If-None-Match:"
+#define IF_MODIFIED_SINCE_HEADER "If-Modified-Since:"
+
+#define DEFAULT_JOBS 6
+#define PARSE_THREADS_MAX 8 /* worker threads parsing season pages */
+#define SPARE_BUFFERS_MAX 8 /* finished download buffers kept for reuse */
+
+#define SECONDS_PER_MINUTE 60
+#define SECONDS_PER_HOUR   (60 * SECONDS_PER_MINUTE)
+#define SECONDS_PER_DAY    (24 * SECONDS_PER_HOUR)
+
+#define DEFAULT_TTL_SEARCH   (7 * SECONDS_PER_DAY)
+#define DEFAULT_TTL_EPISODES (12 * SECONDS_PER_HOUR)
+#define DEFAULT_TTL_SEASON   (12 * SECONDS_PER_HOUR)
+#define DEFAULT_TTL_CAST     (7 * SECONDS_PER_DAY)
+#define MULTI_WAIT_TIMEOUT 1000 /* milliseconds */
+
 #define ATTR_0           0
 #define ATTR_AIR         0x01
 #define ATTR_DESCRIPTION 0x02
@@ -80,8 +135,11 @@
 #define SERIES_DESCRIPTION_PATTERN  "\"og:description\" content=\""
 #define SERIES_TAGLINE_PATTERN      "class=\"tagline\">"
 #define TAGLINE_ENDED               "ended"
-#define SEASON_PATTERN              "<strong>Season %u"
-#define EPISODE_PATTERN             "Episode %u\r\n"
+#define SEASON_MARKER               "<strong>Season "
+#define SEASON_COUNT_PATTERN        "class=\"count\">"
+#define LINK_END                    "</a>"
+#define EPISODE_MARKER              "Episode "
+#define EPISODE_MARKER_END          "\r\n"
 #define EPISODE_AIR_PATTERN         "class=\"date\">"
 #define EPISODE_DESCRIPTION_PATTERN "class=\"description\">"
 #define EPISODE_RATING_PATTERN      "_rating"
@@ -92,22 +150,73 @@
 
 #define EMPTY_DESCRIPTION "(no description)"
 
+/* bytes of a season page kept behind the scan so the title of a link
+   can still be found once its end turns up */
+#define EPISODE_LOOKBEHIND 4096
+
+/* season and episode numbers past this are taken for junk rather than
+   made room for */
+#define NUMBER_MAX 99999
+
+/* episodes a season parser makes room for at first, unless the season
+   list said how many there are */
+#define SEASON_EPISODES_MIN 32
+
+/* fields of an episode found by the season page parser */
+#define EPISODE_HAS_AIR         0x01
+#define EPISODE_HAS_RATING      0x02
+#define EPISODE_HAS_DESCRIPTION 0x04
+
+/* longest character reference decode_entity() knows about ("&#x10FFFF;"
+   or "&#1114111;") */
+#define ENTITY_REF_MAX  10
+#define ENTITY_NAME_MAX 8
+
+/* parameters of entity_hash() that give every name in entities[] a slot
+   of its own */
+#define ENTITY_HASH_SIZE  256
+#define ENTITY_HASH_SEED  UINT32_C (1341)
+#define ENTITY_HASH_PRIME UINT32_C (0x01000193)
+
+#define SERIES_HAS_SEASONS 0x01 /* all of them */
+#define SERIES_HAS_CAST    0x02
+
+#define TITLE_INDEX "titles" /* map of given titles to URL titles */
+
+#define SNAPSHOT_DIR           "series"
+#define SNAPSHOT_SUFFIX        ".snap"
+#define SNAPSHOT_MAGIC         "TVISNAP"
+#define SNAPSHOT_VERSION       5
+#define SNAPSHOT_BYTE_ORDER    0x01020304
+
 #define SPEC_DELIM_C ','
 #define SPEC_DELIM_S ","
 #define SPEC_ERROR_MESSAGE \
   "must be of the form \"N,N,N...\" (e.g. \"1,23\", \"4\", \"5,6,7\", etc.)"
 
+#define TTL_DELIM_C '='
+#define TTL_ERROR_MESSAGE \
+  "must be of the form \"TYPE=N,TYPE=N...\" (e.g. \"season=3600\", " \
+  "\"search=7d,cast=2d\", etc.)"
+
+#define JOBS_ERROR_MESSAGE "must be a positive number (e.g. \"1\", \"8\", etc.)"
+#define RANK_ERROR_MESSAGE "must be a positive number (e.g. \"1\", \"10\", etc.)"
+
 #define PROGRESS_LOADING_MESSAGE "Loading... "
 
 #define ENCODE_CHARS "!@#$%^&*()=+{}[]|\\;':\",<>/? "
 
-#define TITLE               series.title.proper
+#define TITLE               series.title.proper.s
 #define SEASON(n)           series.season[(n)]
 #define LAST_SEASON         SEASON (series.total_seasons - 1)
 #define EPISODE(s, n)       s.episode[(n)]
-#define FIRST_EPISODE_OF(s) s.episode[0]
-#define LAST_EPISODE_OF(s)  s.episode[s.total_episodes - 1]
+#define FIRST_EPISODE_OF(s) \
+  ((s.total_episodes > 0) ? s.episode[0] : no_episode)
+#define LAST_EPISODE_OF(s) \
+  ((s.total_episodes > 0) ? s.episode[s.total_episodes - 1] : no_episode)
 #define PERSON(n)           series.cast.person[(n)]
+#define COLUMN_AIRED(c, i) \
+  (((c)->aired[(unsigned int) (i) / 64] >> ((unsigned int) (i) % 64)) & 1)
 
 #define PROPELLER_ROTATE_INTERVAL 0.25f
 #define propeller_rotate_interval_passed(m) \
@@ -123,102 +232,322 @@
 #define search_url(name) \
   char url_var__ (name)[TVI_BUFMAX]; \
   char *__e = encode_series_given_title (); \
-  snprintf (url_var__ (name), TVI_BUFMAX, SEARCH_URL, __e); \
+  format_url (url_var__ (name), SEARCH_URL, __e); \
   tvi_free (__e)
 
 #define episodes_url(name) \
   char url_var__ (name)[TVI_BUFMAX]; \
-  snprintf (url_var__ (name), TVI_BUFMAX, EPISODES_URL, series.title.url)
+  format_url (url_var__ (name), EPISODES_URL, series.title.url)
 
 #define cast_url(name) \
   char url_var__ (name)[TVI_BUFMAX]; \
-  snprintf (url_var__ (name), TVI_BUFMAX, CAST_URL, series.title.url)
+  format_url (url_var__ (name), CAST_URL, series.title.url)
 
 #define season_url(name, n) \
   char url_var__ (name)[TVI_BUFMAX]; \
-  snprintf (url_var__ (name), TVI_BUFMAX, SEASON_URL, series.title.url, (n))
-
-#define __html_pat_var(name) html_pattern_ ## name
-#define html_pat_var__(name) __html_pat_var (name)
-
-#define season_pattern(name, n) \
-  char html_pat_var__ (name)[TVI_BUFMAX]; \
-  snprintf (html_pat_var__ (name), TVI_BUFMAX, SEASON_PATTERN, (n))
-
-#define episode_pattern(name, n) \
-  char html_pat_var__ (name)[TVI_BUFMAX]; \
-  snprintf (html_pat_var__ (name), TVI_BUFMAX, EPISODE_PATTERN, (n))
+  format_url (url_var__ (name), SEASON_URL, series.title.url, (n))
 /* }}} */
 
 struct episode
 {
   bool has_aired;
   double rating;
-  char air[TVI_BUFMAX];
-  char title[TVI_BUFMAX];
-  char *description;
+  int64_t air_time; /* seconds since the epoch, from AIR and the schedule */
+  struct tvi_str air;
+  struct tvi_str title;
+  const char *description;
 };
 
 struct season
 {
+  bool loaded; /* its page has been retrieved */
   int total_episodes;
   double rating;
-  struct episode episode[TVI_BUFMAX];
+  struct episode *episode; /* TOTAL_EPISODES of them */
+};
+
+/* what the season list of the episodes page says about a season */
+struct season_entry
+{
+  bool listed;
+  int episodes;  /* number of episodes advertised, or -1 if not given */
+  size_t offset; /* of the entry in the episodes page */
 };
 
 struct person
 {
-  size_t n_name;
-  size_t n_role;
-  char name[TVI_BUFMAX];
-  char role[TVI_BUFMAX];
+  struct tvi_str name;
+  struct tvi_str role;
 };
 
 struct cast
 {
   int total_people;
-  struct person person[TVI_BUFMAX];
+  struct person *person; /* TOTAL_PEOPLE of them */
 };
 
 struct schedule
 {
   bool ended;
-  char day[TVI_BUFMAX];
-  char time[TVI_BUFMAX];
-  char network[TVI_BUFMAX];
+  struct tvi_str day;
+  struct tvi_str time;
+  struct tvi_str network;
+};
+
+/* The episodes of the series laid out a column at a time, season after
+   season, for the queries that go through all of them. Column I holds
+   episode I - FIRST[SEASON[I]] of season SEASON[I]. The columns are built
+   again by build_episode_columns() whenever seasons come in, and seasons
+   that are not in take no columns. */
+struct episode_columns
+{
+  int n;
+  int size;          /* columns there is room for */
+  double *rating;    /* -1 for episodes that have not aired */
+  int64_t *air_time;
+  int *season;
+  uint64_t *aired;   /* bit I % 64 of word I / 64 is set if I has aired */
+  int *first;        /* column of the first episode of each season, and
+                        N after the last one */
 };
 
 struct title
 {
-  char proper[TVI_BUFMAX]; /* proper (e.g. "The Wire") */
-  char url[TVI_BUFMAX];    /* for URL (e.g. "the-wire") */
-  char *given;          /* from command line (e.g. "the wire") */
+  struct tvi_str proper; /* proper (e.g. "The Wire") */
+  char url[TVI_BUFMAX];  /* for URL (e.g. "the-wire") */
+  char *given;           /* from command line (e.g. "the wire") */
 };
 
 struct series
 {
+  unsigned int loaded; /* SERIES_HAS_* bits of what has been retrieved */
   int total_episodes;
   int total_seasons;
   double rating;
   struct cast cast;
   struct schedule schedule;
   struct title title;
-  char air_start[TVI_BUFMAX];
-  char air_end[TVI_BUFMAX];
-  struct season season[TVI_BUFMAX];
-  char *description;
+  struct tvi_str air_start; /* air dates of the first and last episodes */
+  struct tvi_str air_end;
+  struct season *season;        /* TOTAL_SEASONS of them */
+  struct season_entry *listing; /* season list, by number (if it was read) */
+  struct episode_columns columns;
+  const char *description;
+  struct tvi_arena strings; /* all text and records of the series */
 };
 
-struct page_content
+/* Season pages are parsed while they download, in a single forward scan
+   for the markers of the season page scanner. Every chunk that arrives is
+   appended to PENDING and scanned as far as it goes; a field cut short by
+   the end of the chunk is picked up again once the next one is in. Bytes
+   the scan is done with are dropped, so only a few kilobytes of the page
+   are held at once.
+
+   The scans run on the worker pool, so that seasons are parsed side by
+   side and apart from the downloads. Chunks are handed over in INCOMING,
+   and a parser is on the pool at most once at a time, which keeps the
+   chunks of a page in order. Everything else of a parser (and the season
+   it fills in) belongs to the job running it until the pool has been
+   waited for. */
+struct season_parser
 {
-  size_t n;
-  char *buffer;
+  struct season *season;
+  struct episode *current;   /* episode being parsed, if any */
+  struct tvi_buffer pending; /* bytes not consumed yet */
+  struct scan_cursor cursor; /* where the scan of PENDING is at */
+  int mark;                  /* marker waiting for the rest of its field */
+  unsigned int fields;       /* EPISODE_HAS_* bits of CURRENT */
+  size_t title_at;           /* offset in PENDING of the text of the last */
+  size_t n_title;            /* link and its length */
+  int size;                  /* episodes the season has room for */
+  bool *seen;                /* which of them have been found */
+  struct tvi_arena strings;  /* text and episodes of the season, for the
+                                series later */
+  pthread_mutex_t lock;      /* guards the members below */
+  struct tvi_buffer incoming; /* bytes handed over and not in PENDING yet */
+  bool queued;               /* a job for the parser is on the pool */
+  bool ending;               /* the whole page has been handed over */
+};
+
+/* Layout of a series snapshot file. Every record has a fixed size and the
+   members are ordered so that no padding is needed; strings are stored as
+   offsets into the string table at the end of the file. */
+struct snapshot_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  int64_t created;
+  double rating;
+  uint32_t flags;
+  uint32_t ended;
+  uint32_t total_seasons;
+  uint32_t total_episodes;
+  uint32_t total_people;
+  uint32_t strings_size;
+  uint32_t title;
+  uint32_t description;
+  uint32_t day;
+  uint32_t time;
+  uint32_t network;
+  uint32_t air_start;
+  uint32_t air_end;
+  uint32_t reserved;
+};
+
+struct snapshot_season
+{
+  double rating;
+  uint32_t loaded;
+  uint32_t total_episodes;
+  uint32_t first_episode;
+  uint32_t reserved;
+};
+
+struct snapshot_episode
+{
+  double rating;
+  uint32_t has_aired;
+  uint32_t air;
+  uint32_t title;
+  uint32_t description;
+};
+
+struct snapshot_person
+{
+  uint32_t name;
+  uint32_t role;
+};
+
+/* A field that has to be found before the rest of a page can be skipped:
+   PATTERN followed (later on) by the END character, which closes the value
+   that comes after it. With AFTER set, PATTERN is only looked for after
+   the previous field. */
+struct page_field
+{
+  bool after;
+  char end;
+  const char *pattern;
+};
+
+#define PAGE_FIELDS_MAX 4
+
+/* Keeps track of which fields of a page have arrived so the transfer can
+   be stopped as soon as they all have. */
+struct page_matcher
+{
+  bool seasons; /* the season list is needed too */
+  int n_fields;
+  const struct page_field *fields;
+  bool found[PAGE_FIELDS_MAX];
+  size_t from[PAGE_FIELDS_MAX]; /* offset to resume looking for a field */
+  size_t season_from;
+  size_t count_from; /* offset to look for the count of season 1 from */
+  int first_season; /* the one listed first */
+  int next_season;  /* the one that should be listed next */
+  bool unordered;   /* the list does not count down one by one */
+};
+
+/* kinds of pages downloaded from TVDOTCOM, each one cached for its own
+   length of time */
+enum
+{
+  PAGE_SEARCH,
+  PAGE_EPISODES,
+  PAGE_SEASON,
+  PAGE_CAST,
+  PAGE_TYPES
+};
+
+/* markers each kind of page is scanned for, numbered by their place in
+   the lists of page_markers */
+enum
+{
+  MARK_SEARCH_SHOW,
+  MARK_SEARCH_HREF
+};
+
+enum
+{
+  MARK_SERIES_TITLE,
+  MARK_SERIES_DESCRIPTION,
+  MARK_SERIES_TAGLINE,
+  MARK_SEASON,
+  MARK_SEASON_COUNT
+};
+
+enum
+{
+  MARK_LINK_END,
+  MARK_EPISODE,
+  MARK_EPISODE_AIR,
+  MARK_EPISODE_DESCRIPTION,
+  MARK_EPISODE_RATING
+};
+
+enum
+{
+  MARK_CAST_NAME,
+  MARK_CAST_ROLE
+};
+
+/* offsets in PAGE of every marker found in it, one list for each marker */
+struct page_marks
+{
+  size_t n[SCAN_PATTERNS_MAX];
+  size_t size[SCAN_PATTERNS_MAX];
+  size_t *at[SCAN_PATTERNS_MAX];
+};
+
+/* long options that have no short equivalent */
+enum
+{
+  OPT_CACHE_DIR = CHAR_MAX + 1,
+  OPT_CACHE_TTL,
+  OPT_NO_CACHE,
+  OPT_REFRESH,
+  OPT_TOP,
+  OPT_BOTTOM
+};
+
+struct transfer_stats
+{
+  long transfers; /* completed transfers */
+  long failed;    /* transfers of optional pages that failed */
+  long connects;  /* transfers that had to open a new connection */
+  long reused;    /* transfers that went over an already open connection */
+  long cached;    /* pages served from the page cache */
+  long revalidated; /* stale cached pages the server said are unchanged */
+  curl_off_t received; /* body bytes as sent over the wire (compressed) */
+  curl_off_t decoded;  /* body bytes handed to fetch_write_cb() */
+};
+
+struct fetch
+{
+  bool keep; /* collect the body in PAGE (always done if it is cached) */
+  bool fed;  /* the body went through FEED while it was downloading */
+  bool stopped; /* MATCHER had everything, so the transfer was cut short */
+  bool optional; /* failing to retrieve the page is not an error */
+  bool failed;   /* set instead of giving up when OPTIONAL */
+  int season;
+  int type;
+  size_t n_body; /* body bytes received */
+  void (*feed) (struct fetch *, const char *, size_t);
+  void *data;    /* for use by FEED */
+  struct page_matcher *matcher;
+  CURL *cp;
+  struct curl_slist *headers;
+  char url[TVI_BUFMAX];
+  struct tvi_buffer page;
+  struct tvi_buffer cached; /* stale cache entry being revalidated */
+  struct cache_validators validators;
 };
 
 struct spec
 {
   int n;
-  int v[TVI_BUFMAX];
+  int size;
+  int *v;
 };
 
 struct token
@@ -241,8 +570,17 @@ struct tvi_options
   bool last;
   bool lowest_rated;
   bool next;
+  bool rank_seasons; /* --top or --bottom ranks each season given */
+  bool refresh;
   bool show_progress;
+  bool stats;
+  bool use_cache;
   char attrs;
+  int jobs;
+  int top;
+  int bottom;
+  time_t ttl[PAGE_TYPES];
+  const char *cache_dir;
   char cast_pattern[TVI_BUFMAX];
   struct spec e;
   struct spec s;
@@ -251,35 +589,122 @@ struct tvi_options
 const char *program_name;
 
 static struct series series;
-static struct page_content page = {0, NULL};
+static const struct tvi_str no_text = TVI_STR_INIT;
+/* stands in for the first and last episodes of a season without any */
+static const struct episode no_episode = {false, 0.0, 0, TVI_STR_INIT,
+                                          TVI_STR_INIT, ""};
+static struct tvi_buffer page = TVI_BUFFER_INIT;
+static struct tvi_buffer spare_buffers[SPARE_BUFFERS_MAX];
+static int n_spare_buffers = 0;
+static struct page_marks marks;
+static struct scanner scanners[PAGE_TYPES];
+static struct pool workers;
+/* what air times are measured against, see init_air_clock() */
+static int64_t air_clock_now;
+static int64_t utc_offset;
+static bool have_workers = false;
+static struct transfer_stats stats = {0L, 0L, 0L, 0L, 0L, 0L, 0, 0};
+static CURLSH *share = NULL;
 
-static size_t n_series_title_pattern = 0;
-static size_t n_series_description_pattern  = 0;
-static size_t n_series_tagline_pattern = 0;
 static size_t n_tagline_ended = 0;
+static size_t n_link_end = 0;
+static size_t n_episode_marker = 0;
+static size_t n_episode_marker_end = 0;
 static size_t n_episode_air_pattern = 0;
 static size_t n_episode_description_pattern = 0;
 static size_t n_episode_rating_pattern = 0;
 static size_t n_search_show_pattern = 0;
 static size_t n_search_href_pattern = 0;
-static size_t n_cast_name_pattern = 0;
-static size_t n_cast_role_pattern = 0;
+static size_t n_http_status_prefix = 0;
+
+/* all parse_search_page() looks at */
+static const struct page_field search_fields[] =
+{
+  {false, '\0', SEARCH_SHOW_PATTERN},
+  {true, '/', SEARCH_HREF_PATTERN}
+};
+
+/* all parse_episodes_page() looks at, besides the season list */
+static const struct page_field episodes_fields[] =
+{
+  {false, '-', SERIES_TITLE_PATTERN},
+  {false, '"', SERIES_DESCRIPTION_PATTERN},
+  {false, '<', SERIES_TAGLINE_PATTERN}
+};
+
+static const char *const search_markers[] =
+{
+  SEARCH_SHOW_PATTERN,
+  SEARCH_HREF_PATTERN,
+  NULL
+};
+
+static const char *const episodes_markers[] =
+{
+  SERIES_TITLE_PATTERN,
+  SERIES_DESCRIPTION_PATTERN,
+  SERIES_TAGLINE_PATTERN,
+  SEASON_MARKER,
+  SEASON_COUNT_PATTERN,
+  NULL
+};
+
+static const char *const season_markers[] =
+{
+  LINK_END,
+  EPISODE_MARKER,
+  EPISODE_AIR_PATTERN,
+  EPISODE_DESCRIPTION_PATTERN,
+  EPISODE_RATING_PATTERN,
+  NULL
+};
+
+static const char *const cast_markers[] =
+{
+  CAST_NAME_PATTERN,
+  CAST_ROLE_PATTERN,
+  NULL
+};
+
+static const char *const *const page_markers[PAGE_TYPES] =
+{
+  search_markers,
+  episodes_markers,
+  season_markers,
+  cast_markers
+};
+
+static const char *const page_type_names[PAGE_TYPES] =
+{
+  "search",
+  "episodes",
+  "season",
+  "cast"
+};
 
 static struct option const options[] =
 {
   {"air", no_argument, NULL, 'a'},
+  {"bottom", required_argument, NULL, OPT_BOTTOM},
+  {"cache-dir", required_argument, NULL, OPT_CACHE_DIR},
+  {"cache-ttl", required_argument, NULL, OPT_CACHE_TTL},
   {"cast", optional_argument, NULL, 'c'},
   {"desc", no_argument, NULL, 'd'},
   {"episode", required_argument, NULL, 'e'},
   {"help", no_argument, NULL, 'h'},
   {"highest-rated", no_argument, NULL, 'H'},
   {"info", no_argument, NULL, 'i'},
+  {"jobs", required_argument, NULL, 'j'},
   {"last", no_argument, NULL, 'l'},
   {"lowest-rated", no_argument, NULL, 'L'},
   {"next", no_argument, NULL, 'n'},
+  {"no-cache", no_argument, NULL, OPT_NO_CACHE},
   {"no-progress", no_argument, NULL, 'N'},
   {"rating", no_argument, NULL, 'r'},
+  {"refresh", no_argument, NULL, OPT_REFRESH},
   {"season", required_argument, NULL, 's'},
+  {"stats", no_argument, NULL, 'S'},
+  {"top", required_argument, NULL, OPT_TOP},
   {"version", no_argument, NULL, 'v'},
   {NULL, 0, NULL, 0}
 };
@@ -305,8 +730,8 @@ static void
 usage (bool had_error)
 {
   fprintf ((!had_error) ? stdout : stderr,
-           "Usage: %s [-adHilLnNr] [-c[NAME]] [-sN[,N,...]] [-eN[,N,...]] "
-             "TITLE\n",
+           "Usage: %s [-adHilLnNrS] [-c[NAME]] [-jN] [-sN[,N,...]] "
+             "[-eN[,N,...]] TITLE\n",
            program_name);
 
   if (!had_error)
@@ -325,17 +750,41 @@ version (void)
 static void
 set_pattern_sizes (void)
 {
-  n_series_title_pattern = strlen (SERIES_TITLE_PATTERN);
-  n_series_description_pattern = strlen (SERIES_DESCRIPTION_PATTERN);
-  n_series_tagline_pattern = strlen (SERIES_TAGLINE_PATTERN);
   n_tagline_ended = strlen (TAGLINE_ENDED);
+  n_link_end = strlen (LINK_END);
+  n_episode_marker = strlen (EPISODE_MARKER);
+  n_episode_marker_end = strlen (EPISODE_MARKER_END);
   n_episode_air_pattern = strlen (EPISODE_AIR_PATTERN);
   n_episode_description_pattern = strlen (EPISODE_DESCRIPTION_PATTERN);
   n_episode_rating_pattern = strlen (EPISODE_RATING_PATTERN);
   n_search_show_pattern = strlen (SEARCH_SHOW_PATTERN);
   n_search_href_pattern = strlen (SEARCH_HREF_PATTERN);
-  n_cast_name_pattern = strlen (CAST_NAME_PATTERN);
-  n_cast_role_pattern = strlen (CAST_ROLE_PATTERN);
+  n_http_status_prefix = strlen (HTTP_STATUS_PREFIX);
+}
+
+static void
+init_scanners (void)
+{
+  int i;
+  int n;
+
+  for (i = 0; i < PAGE_TYPES; ++i)
+  {
+    for (n = 0; page_markers[i][n]; ++n)
+      ;
+    scanner_init (&scanners[i], page_markers[i], n);
+  }
+}
+
+static void
+free_scanners (void)
+{
+  int i;
+
+  for (i = 0; i < PAGE_TYPES; ++i)
+    scanner_free (&scanners[i]);
+  for (i = 0; i < SCAN_PATTERNS_MAX; ++i)
+    tvi_free (marks.at[i]);
 }
 
 static void
@@ -368,6 +817,22 @@ set_series_given_title (char **item)
   *t = '\0';
 }
 
+/* Formats the URL of a page into URL, which has room for TVI_BUFMAX
+   bytes. A URL that does not fit would be a different page, so rather
+   than cut it short tvi gives up. */
+static void
+format_url (char *url, const char *format, ...)
+{
+  int n;
+  va_list args;
+
+  va_start (args, format);
+  n = vsnprintf (url, TVI_BUFMAX, format, args);
+  va_end (args);
+  if (n < 0 || n >= TVI_BUFMAX)
+    tvi_die (E_OPTION, "the URL for \"%s\" is too long", series.title.given);
+}
+
 static char *
 encode_series_given_title (void)
 {
@@ -418,19 +883,199 @@ encode_series_given_title (void)
   return encoded;
 }
 
+/* Download buffers are recycled rather than freed, so the memory of a page
+   that has been parsed is used again by the next transfer. */
+static void
+buffer_get (struct tvi_buffer *b)
+{
+  if (n_spare_buffers > 0)
+    *b = spare_buffers[--n_spare_buffers];
+  else
+  {
+    b->n = 0;
+    b->size = 0;
+    b->buffer = NULL;
+  }
+  tvi_buffer_clear (b);
+  tvi_buffer_reserve (b, 0);
+}
+
+static void
+buffer_put (struct tvi_buffer *b)
+{
+  if (!b->buffer)
+    return;
+  if (n_spare_buffers < SPARE_BUFFERS_MAX)
+  {
+    spare_buffers[n_spare_buffers++] = *b;
+    b->buffer = NULL;
+    b->n = 0;
+    b->size = 0;
+  }
+  else
+    tvi_buffer_free (b);
+}
+
+static void
+free_spare_buffers (void)
+{
+  while (n_spare_buffers > 0)
+    tvi_buffer_free (&spare_buffers[--n_spare_buffers]);
+}
+
+static void
+init_page_matcher (struct page_matcher *m, int type)
+{
+  memset (m, 0, sizeof (*m));
+  if (type == PAGE_SEARCH)
+  {
+    m->fields = search_fields;
+    m->n_fields = sizeof (search_fields) / sizeof (*search_fields);
+  }
+  else if (type == PAGE_EPISODES)
+  {
+    m->fields = episodes_fields;
+    m->n_fields = sizeof (episodes_fields) / sizeof (*episodes_fields);
+    m->seasons = true;
+  }
+}
+
+/* Looks for the season list markers that have arrived in P. The list
+   starts with the newest season and counts down, so it is complete once
+   season 1 has been seen along with the count of its episodes, which
+   parse_season_list() looks for anywhere after it. A list that starts at
+   season 1 could still go on, so such pages are read to the end, as are
+   lists in any other order and lists with another marker after season 1
+   (which would have cut its entry short). */
+static bool
+page_matcher_seasons (struct page_matcher *m, const struct tvi_buffer *p)
+{
+  int v;
+  size_t n_marker;
+  const char *d;
+  const char *q;
+
+  n_marker = strlen (SEASON_MARKER);
+  for (q = p->buffer + m->season_from; (q = strstr (q, SEASON_MARKER)); q = d)
+  {
+    d = q + n_marker;
+    for (v = 0; isdigit (*d) && v <= NUMBER_MAX; ++d)
+      v = v * 10 + (*d - '0');
+    if (!*d)
+    {
+      /* the number may go on in the next chunk */
+      m->season_from = q - p->buffer;
+      return false;
+    }
+    if (v < 1 || v > NUMBER_MAX)
+      continue;
+    if (m->first_season == 0)
+      m->first_season = m->next_season = v;
+    if (v == m->next_season)
+    {
+      m->next_season--;
+      m->count_from = d - p->buffer;
+    }
+    else if (m->next_season == 0 || v < m->next_season ||
+             v > m->first_season)
+      m->unordered = true;
+  }
+
+  if (p->n >= n_marker)
+    m->season_from = p->n - (n_marker - 1);
+  if (m->first_season < 2 || m->next_season > 0 || m->unordered)
+    return false;
+
+  n_marker = strlen (SEASON_COUNT_PATTERN);
+  q = strstr (p->buffer + m->count_from, SEASON_COUNT_PATTERN);
+  if (!q)
+  {
+    if (p->n >= n_marker && p->n - (n_marker - 1) > m->count_from)
+      m->count_from = p->n - (n_marker - 1);
+    return false;
+  }
+  /* the count stays where it is until the text of it is closed */
+  m->count_from = q - p->buffer;
+  return strchr (q + n_marker, '<') != NULL;
+}
+
+/* Returns true once all of the fields M is looking for are in P. */
+static bool
+page_matcher_done (struct page_matcher *m, const struct tvi_buffer *p)
+{
+  bool done;
+  int i;
+  size_t n;
+  const char *q;
+
+  done = true;
+  for (i = 0; i < m->n_fields; ++i)
+  {
+    if (m->found[i])
+      continue;
+    if (m->fields[i].after && i > 0 && !m->found[i - 1])
+      return false;
+    n = strlen (m->fields[i].pattern);
+    q = strstr (p->buffer + m->from[i], m->fields[i].pattern);
+    if (!q)
+    {
+      if (p->n >= n && p->n - (n - 1) > m->from[i])
+        m->from[i] = p->n - (n - 1);
+      done = false;
+      continue;
+    }
+    /* the pattern stays where it is until the value after it is closed */
+    m->from[i] = q - p->buffer;
+    if (m->fields[i].end && !strchr (q + n, m->fields[i].end))
+    {
+      done = false;
+      continue;
+    }
+    m->found[i] = true;
+    if (i + 1 < m->n_fields && m->fields[i + 1].after)
+      m->from[i + 1] = m->from[i] + n;
+  }
+
+  if (m->seasons && !page_matcher_seasons (m, p))
+    done = false;
+  return done;
+}
+
 static size_t
-page_write_cb (void *buf, size_t size, size_t nmemb, void *data)
+fetch_write_cb (void *buf, size_t size, size_t nmemb, void *data)
 {
   size_t n;
-  struct page_content *p;
+  curl_off_t length = 0;
+  struct fetch *f;
 
-  p = (struct page_content *) data;
+  f = (struct fetch *) data;
   n = size * nmemb;
 
-  p->buffer = tvi_renewa (char, p->buffer, p->n + n + 1);
-  memcpy (p->buffer + p->n, buf, n);
-  p->n += n;
-  p->buffer[p->n] = '\0';
+  /* the length of the body is known up front most of the time, so make
+     room for all of it at once (for a compressed body this is the size on
+     the wire, which is still a good start) */
+  if (f->n_body == 0 && f->keep &&
+      curl_easy_getinfo (f->cp, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                         &length) == CURLE_OK && length > 0)
+    tvi_buffer_reserve (&f->page, (size_t) length);
+
+  f->n_body += n;
+  if (f->keep)
+    tvi_buffer_append (&f->page, (const char *) buf, n);
+  if (f->feed)
+  {
+    f->feed (f, (const char *) buf, n);
+    f->fed = true;
+  }
+
+  /* returning less than N makes libcurl abort the transfer */
+  if (f->keep && f->matcher && page_matcher_done (f->matcher, &f->page))
+  {
+    tvi_debug ("got all that is needed from \"%s\" after %zu bytes",
+               f->url, f->n_body);
+    f->stopped = true;
+    return 0;
+  }
   return n;
 }
 
@@ -507,755 +1152,2542 @@ check_curl_status (CURL *cp, CURLcode status)
   }
 }
 
-static bool
-try_connect (const char *url, const struct tvi_options *x)
+/* All transfers of a run go to the same host, so every easy handle is
+   attached to one share object that keeps the DNS cache and the open
+   connections alive between requests. */
+static void
+init_connection_context (void)
 {
-  CURL *cp = curl_easy_init ();
+  CURLcode status;
+
+  status = curl_global_init (CURL_GLOBAL_DEFAULT);
+  if (status != CURLE_OK)
+    tvi_die (E_INTERNET, "failed to initialize libcurl: %s",
+             curl_easy_strerror (status));
+
+  if (!(curl_version_info (CURLVERSION_NOW)->features & CURL_VERSION_LIBZ))
+    tvi_debug ("libcurl has no zlib support, pages will not be compressed");
+
+  share = curl_share_init ();
+  if (!share)
+    return;
 
-  if (!cp)
+  curl_share_setopt (share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x073900
+  curl_share_setopt (share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+static void
+cleanup_connection_context (void)
+{
+  if (share)
   {
-    tvi_error (0, "failed to initialize libcurl: %s",
-               curl_easy_strerror (CURLE_FAILED_INIT));
-    return false;
+    curl_share_cleanup (share);
+    share = NULL;
   }
+  curl_global_cleanup ();
+}
+
+static void
+record_transfer_stats (CURL *cp, size_t decoded)
+{
+  long n = 0L;
+  curl_off_t size = 0;
+
+  stats.transfers++;
+  stats.decoded += decoded;
+  if (curl_easy_getinfo (cp, CURLINFO_SIZE_DOWNLOAD_T, &size) == CURLE_OK)
+    stats.received += size;
+  if (curl_easy_getinfo (cp, CURLINFO_NUM_CONNECTS, &n) != CURLE_OK)
+    return;
+  if (n > 0L)
+    stats.connects += n;
+  else
+    stats.reused++;
+}
 
-  tvi_debug ("connecting to \"%s\"...", url);
-  page.n = 0;
-  page.buffer = tvi_newa (char, 1);
+static void
+display_transfer_stats (void)
+{
+  fprintf (stderr, "%s: %li pages from cache, %li pages revalidated, "
+                   "%li transfers (%li failed), %li new connections, "
+                   "%li reused connections\n",
+           program_name, stats.cached, stats.revalidated, stats.transfers,
+           stats.failed, stats.connects, stats.reused);
+  fprintf (stderr, "%s: %" CURL_FORMAT_CURL_OFF_T " bytes received, "
+                   "%" CURL_FORMAT_CURL_OFF_T " bytes after decoding\n",
+           program_name, stats.received, stats.decoded);
+}
 
-#define __setopt(o, p) check_curl_status (cp, curl_easy_setopt (cp, o, p))
+static void
+setup_connection (CURL *cp,
+                  const char *url,
+                  struct fetch *f,
+                  const struct tvi_options *x)
+{
+#define __setopt(o, v) check_curl_status (cp, curl_easy_setopt (cp, o, v))
   __setopt (CURLOPT_URL, url);
   __setopt (CURLOPT_USERAGENT, USERAGENT);
   __setopt (CURLOPT_FAILONERROR, 1L);
   __setopt (CURLOPT_FOLLOWLOCATION, 1L);
-  __setopt (CURLOPT_WRITEDATA, &page);
-  __setopt (CURLOPT_WRITEFUNCTION, &page_write_cb);
+  /* an empty string offers every encoding this libcurl can decode; the
+     body is inflated as it streams in, before fetch_write_cb() sees it */
+  __setopt (CURLOPT_ACCEPT_ENCODING, "");
+  __setopt (CURLOPT_WRITEDATA, f);
+  __setopt (CURLOPT_WRITEFUNCTION, &fetch_write_cb);
   __setopt (CURLOPT_NOPROGRESS, 0L);
   __setopt (CURLOPT_PROGRESSDATA, x);
   __setopt (CURLOPT_PROGRESSFUNCTION, &progress_cb);
+  if (share)
+    __setopt (CURLOPT_SHARE, share);
 #undef __setopt
+}
 
-  bool result = true;
-
-  CURLcode status = curl_easy_perform (cp);
-  progress_finish ();
-
-  if (status != CURLE_OK)
-  {
-    long res = 0L;
-    if (curl_easy_getinfo (cp, CURLINFO_RESPONSE_CODE, &res) == CURLE_OK)
-      tvi_error (0, "%s (http response=%li)",
-                 curl_easy_strerror (status), res);
-    else
-      tvi_error (0, curl_easy_strerror (status));
-    result = false;
-  }
+static void
+report_connection_error (CURL *cp, CURLcode status)
+{
+  long res = 0L;
 
-  curl_easy_cleanup (cp);
-  return result;
+  if (curl_easy_getinfo (cp, CURLINFO_RESPONSE_CODE, &res) == CURLE_OK)
+    tvi_error (0, "%s (http response=%li)", curl_easy_strerror (status), res);
+  else
+    tvi_error (0, curl_easy_strerror (status));
 }
 
-static const struct
+static void
+init_fetch (struct fetch *f, int type)
 {
-  char c;
-  size_t n1;
-  size_t n2;
-  char *s1;
-  char *s2;
-}
-entity_ref[] =
-{
-  {'"', 6, 5, "&quot;", "&#34;"},
-  {'&', 5, 5, "&amp;", "&#38;"},
-  {'\'', 6, 5, "&apos;", "&#39;"},
-  {'<', 4, 5, "&lt;", "&#60;"},
-  {'>', 4, 5, "&gt;", "&#62;"},
-  {' ', 6, 6, "&nbsp;", "&#160;"},
-  {'\0', 0, 0, NULL, NULL}
-};
+  f->keep = true;
+  f->fed = false;
+  f->season = -1;
+  f->type = type;
+  f->n_body = 0;
+  f->feed = NULL;
+  f->data = NULL;
+  f->stopped = false;
+  f->optional = false;
+  f->failed = false;
+  f->matcher = NULL;
+  f->cp = NULL;
+  f->headers = NULL;
+  *f->url = '\0';
+  f->page.n = 0;
+  f->page.size = 0;
+  f->page.buffer = NULL;
+  f->cached.n = 0;
+  f->cached.size = 0;
+  f->cached.buffer = NULL;
+  *f->validators.etag = '\0';
+  *f->validators.last_modified = '\0';
+}
 
+/* Looks F up in the page cache. Returns true if the cached page is fresh
+   enough to be used as is. A stale page that can be revalidated is kept
+   in F->cached along with its validators so that the transfer started for
+   it can be made conditional. */
 static bool
-is_entity_ref (const char *s)
+load_cached_page (struct fetch *f, const struct tvi_options *x)
 {
-  size_t i;
+  if (!x->use_cache || x->refresh)
+    return false;
 
-  for (i = 0; entity_ref[i].c; ++i)
-    if (tvi_strncasecmp (s, entity_ref[i].s1, entity_ref[i].n1) == 0 ||
-        memcmp (s, entity_ref[i].s2, entity_ref[i].n2) == 0)
+  switch (cache_load (f->url, x->ttl[f->type],
+                      &f->cached.buffer, &f->cached.n, &f->validators))
+  {
+    case CACHE_FRESH:
+      f->cached.size = f->cached.n + 1;
+      f->page = f->cached;
+      f->cached.buffer = NULL;
+      f->cached.n = 0;
+      f->cached.size = 0;
+      stats.cached++;
       return true;
-  return false;
+    case CACHE_STALE:
+      f->cached.size = f->cached.n + 1;
+      return false;
+    default:
+      *f->validators.etag = '\0';
+      *f->validators.last_modified = '\0';
+      return false;
+  }
 }
 
-static char
-entity_ref_char (char **s)
+static bool
+header_value (const char *buf, size_t n, const char *name, char *value)
 {
-  size_t i;
-  size_t n = 0;
+  size_t n_name;
+
+  n_name = strlen (name);
+  if (n <= n_name || tvi_strncasecmp (buf, name, n_name) != 0)
+    return false;
 
-  for (i = 0; entity_ref[i].c; ++i)
+  for (buf += n_name, n -= n_name; n > 0 && isspace (*buf); ++buf, --n)
+    ;
+  while (n > 0 && isspace (buf[n - 1]))
+    n--;
+
+  if (n < TVI_BUFMAX)
   {
-    if (tvi_strncasecmp (*s, entity_ref[i].s1, entity_ref[i].n1) == 0)
-      n = entity_ref[i].n1;
-    else if (memcmp (*s, entity_ref[i].s2, entity_ref[i].n2) == 0)
-      n = entity_ref[i].n2;
-    if (n != 0)
-    {
-      *s += n;
-      return entity_ref[i].c;
-    }
+    memcpy (value, buf, n);
+    value[n] = '\0';
   }
-  return '&';
+  return true;
 }
 
-static void
-set_url_title_best_guess (void)
+static size_t
+header_cb (char *buf, size_t size, size_t nmemb, void *data)
 {
-  char *g;
-  char *u;
+  size_t n;
+  struct cache_validators *v;
 
-  for (g = series.title.given, u = series.title.url; *g; ++g, ++u)
-  {
-    if (*g == '\'' || *g == ':' || *g == '.' || *g == ' ')
-    {
-      if (*g == ' ')
-        *u = '-';
-      continue;
-    }
-    *u = *g;
-  }
-  *u = '\0';
+  v = (struct cache_validators *) data;
+  n = size * nmemb;
 
-  tvi_debug ("guessed URL title for \"%s\": \"%s\"",
-             series.title.given, series.title.url);
+  /* a status line starts the headers of a new response (e.g. after a
+     redirect), so forget whatever validators the previous one sent */
+  if (n > n_http_status_prefix &&
+      memcmp (buf, HTTP_STATUS_PREFIX, n_http_status_prefix) == 0)
+  {
+    *v->etag = '\0';
+    *v->last_modified = '\0';
+  }
+  else if (!header_value (buf, n, ETAG_HEADER, v->etag))
+    header_value (buf, n, LAST_MODIFIED_HEADER, v->last_modified);
+  return n;
 }
 
+/* Adds If-None-Match/If-Modified-Since headers built from the validators
+   of a stale cache entry so the server can answer with a bodiless 304 when
+   the page has not changed. */
 static void
-parse_search_page (void)
+setup_revalidation (struct fetch *f)
 {
-  char *p;
+  char h[TVI_BUFMAX * 2];
+
+  if (!f->cached.buffer)
+    return;
 
-  p = strstr (page.buffer, SEARCH_SHOW_PATTERN);
-  if (p)
+  if (*f->validators.etag)
   {
-    char *h = strstr (p, SEARCH_HREF_PATTERN);
-    if (h)
-    {
-      char *u;
-      h += n_search_href_pattern;
-      for (u = series.title.url; *h != '/'; ++h, ++u)
-        *u = *h;
-      *u = '\0';
-    }
+    snprintf (h, sizeof (h), IF_NONE_MATCH_HEADER " %s", f->validators.etag);
+    f->headers = curl_slist_append (f->headers, h);
   }
-
-  if (!*series.title.url)
+  if (*f->validators.last_modified)
   {
-    tvi_debug ("failed to parse title for URL; guessing...");
-    set_url_title_best_guess ();
+    snprintf (h, sizeof (h), IF_MODIFIED_SINCE_HEADER " %s",
+              f->validators.last_modified);
+    f->headers = curl_slist_append (f->headers, h);
   }
+  if (f->headers)
+    check_curl_status (f->cp,
+                       curl_easy_setopt (f->cp, CURLOPT_HTTPHEADER,
+                                         f->headers));
 }
 
+/* Starts the transfer for F on the multi handle MP. */
 static void
-parse_series_proper_title (void)
+fetch_start (CURLM *mp, struct fetch *f, const struct tvi_options *x)
 {
-  char *p;
-  char *t;
-
-  series.title.proper[0] = '\0';
-  p = strstr (page.buffer, SERIES_TITLE_PATTERN);
-
-  if (p && *p)
-  {
-    p += n_series_title_pattern;
-    for (t = series.title.proper; *p && *p != '-'; ++p, ++t)
-      *t = *p;
-    *t = '\0';
-  }
+  CURLMcode status;
+
+  f->cp = curl_easy_init ();
+  if (!f->cp)
+    tvi_die (E_INTERNET, "failed to initialize libcurl: %s",
+             curl_easy_strerror (CURLE_FAILED_INIT));
+
+  tvi_debug ("connecting to \"%s\"...", f->url);
+  /* a page that is parsed as it streams in is only collected when it has
+     to be written to the cache afterwards */
+  f->keep = x->use_cache || !f->feed;
+  f->fed = false;
+  f->stopped = false;
+  f->n_body = 0;
+  buffer_get (&f->page);
+  setup_connection (f->cp, f->url, f, x);
+  setup_revalidation (f);
+
+#define __setopt(o, v) check_curl_status (f->cp, curl_easy_setopt (f->cp, o, v))
+  __setopt (CURLOPT_HEADERFUNCTION, &header_cb);
+  __setopt (CURLOPT_HEADERDATA, &f->validators);
+  __setopt (CURLOPT_PRIVATE, f);
+#undef __setopt
 
-  if (!*series.title.proper)
-    tvi_debug ("failed to parse proper title");
-  tvi_strip_trailing_space (series.title.proper);
+  status = curl_multi_add_handle (mp, f->cp);
+  if (status != CURLM_OK)
+    tvi_die (E_INTERNET, "libcurl error: %s", curl_multi_strerror (status));
 }
 
+/* Wraps up the completed transfer of F: a 304 answer means the stale
+   cached copy is still good, anything else replaces the cache entry.
+   A page cut short once its matcher had everything is cached without its
+   validators, which are those of the whole page: it is used until its TTL
+   runs out and then downloaded again, never revalidated. */
 static void
-parse_series_description (void)
+fetch_finish (struct fetch *f, const struct tvi_options *x)
 {
-  size_t n;
-  char *d;
-  char *p;
+  long res = 0L;
 
-  n = 0;
-  p = strstr (page.buffer, SERIES_DESCRIPTION_PATTERN);
+  curl_easy_getinfo (f->cp, CURLINFO_RESPONSE_CODE, &res);
 
-  if (p && *p)
+  if (res == HTTP_NOT_MODIFIED && f->cached.buffer)
   {
-    p += n_series_description_pattern;
-    for (; *p && *p != '"'; ++p, ++n)
-      ;
+    tvi_debug ("\"%s\" has not been modified", f->url);
+    buffer_put (&f->page);
+    f->page = f->cached;
+    f->cached.buffer = NULL;
+    f->cached.n = 0;
+    f->cached.size = 0;
+    cache_touch (f->url);
+    stats.revalidated++;
   }
-
-  if (n == 0)
+  else
   {
-    series.description = tvi_strdup (EMPTY_DESCRIPTION, -1);
-    return;
+    tvi_buffer_free (&f->cached);
+    if (f->stopped)
+    {
+      *f->validators.etag = '\0';
+      *f->validators.last_modified = '\0';
+    }
+    if (x->use_cache)
+      cache_store (f->url, f->page.buffer, f->page.n, &f->validators);
   }
 
-  series.description = tvi_newa (char, n + 1);
-  p = strstr (page.buffer, SERIES_DESCRIPTION_PATTERN);
+  curl_slist_free_all (f->headers);
+  f->headers = NULL;
+  curl_easy_cleanup (f->cp);
+  f->cp = NULL;
+}
+
+/* Drops the failed transfer of an optional page. */
+static void
+fetch_fail (struct fetch *f)
+{
+  f->failed = true;
+  buffer_put (&f->page);
+  tvi_buffer_free (&f->cached);
+  curl_slist_free_all (f->headers);
+  f->headers = NULL;
+  curl_easy_cleanup (f->cp);
+  f->cp = NULL;
+}
+
+/* Starts transfers for the entries of F from *NEXT on until X->jobs of them
+   are running. Entries found in the page cache are handed to DONE right
+   away without touching the network. */
+static void
+fetch_fill (CURLM *mp,
+            struct fetch *f,
+            int n,
+            int *next,
+            int *active,
+            void (*done) (struct fetch *),
+            const struct tvi_options *x)
+{
+  struct fetch *p;
 
-  if (p && *p)
+  while (*next < n && *active < x->jobs)
   {
-    p += n_series_description_pattern;
-    for (d = series.description; *p && *p != '"'; ++d, ++p)
+    p = &f[(*next)++];
+    if (load_cached_page (p, x))
     {
-      while (is_entity_ref (p))
-        *d++ = entity_ref_char (&p);
-      *d = *p;
+      done (p);
+      continue;
     }
-    *d = '\0';
+    fetch_start (mp, p, x);
+    (*active)++;
   }
-
-  if (!series.description || !*series.description)
-    tvi_debug ("failed to parse series description");
 }
 
+/* Downloads every entry of F (N in total) concurrently, never running more
+   than X->jobs transfers at once. DONE is called on each entry as soon as
+   its transfer completes so that parsing overlaps with the downloads still
+   in flight. */
 static void
-parse_series_schedule (void)
+fetch_all (struct fetch *f,
+           int n,
+           void (*done) (struct fetch *),
+           const struct tvi_options *x)
 {
-  char *e;
-  char *p;
-  char *q;
-  char tagline[TVI_BUFMAX];
-  struct schedule *s = &series.schedule;
-
-  p = strstr (page.buffer, SERIES_TAGLINE_PATTERN);
-  if (p && *p)
+  int active;
+  int next;
+  int pending;
+  int running;
+  CURLM *mp;
+  CURLMsg *msg;
+  CURLMcode status;
+  struct fetch *p;
+
+  mp = curl_multi_init ();
+  if (!mp)
+    tvi_die (E_INTERNET, "failed to initialize libcurl: %s",
+             curl_easy_strerror (CURLE_FAILED_INIT));
+
+  active = 0;
+  next = 0;
+  fetch_fill (mp, f, n, &next, &active, done, x);
+
+  while (active > 0)
   {
-    p += n_series_tagline_pattern;
-    for (q = tagline; *p && *p != '<'; ++q, ++p)
-      *q = *p;
-    *q = '\0';
-    e = strstr (tagline, TAGLINE_ENDED);
-    if (e && *e)
+    status = curl_multi_perform (mp, &running);
+    if (status != CURLM_OK)
+      tvi_die (E_INTERNET, "libcurl error: %s", curl_multi_strerror (status));
+
+    while ((msg = curl_multi_info_read (mp, &pending)))
     {
-      /* tagline will be of the form:
-           "NETWORK (ended YEAR)"
-         example: "AMC (ended 2013)" */
-      s->ended = true;
-      for (p = tagline, q = s->network; *p != ' '; ++q, ++p)
-        *q = *p;
-      *q = '\0';
-      e += n_tagline_ended;
-      while (*e == ' ')
-        e++;
-      for (q = s->time; *e != ')'; ++q, ++e)
-        *q = *e;
-      *q = '\0';
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+      p = NULL;
+      curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, (char **) &p);
+      curl_multi_remove_handle (mp, p->cp);
+      if (msg->data.result != CURLE_OK &&
+          !(msg->data.result == CURLE_WRITE_ERROR && p->stopped))
+      {
+        if (p->optional)
+        {
+          tvi_debug ("failed to retrieve \"%s\": %s", p->url,
+                     curl_easy_strerror (msg->data.result));
+          record_transfer_stats (p->cp, p->n_body);
+          stats.failed++;
+          fetch_fail (p);
+          active--;
+          fetch_fill (mp, f, n, &next, &active, done, x);
+          continue;
+        }
+        progress_finish ();
+        report_connection_error (p->cp, msg->data.result);
+        tvi_die (E_INTERNET, "failed to connect to \"%s\"", p->url);
+      }
+      record_transfer_stats (p->cp, p->n_body);
+      fetch_finish (p, x);
+      active--;
+      fetch_fill (mp, f, n, &next, &active, done, x);
+      done (p);
     }
-    else
+
+    if (active > 0)
     {
-      /* tagline will be of the form:
-           "DAY TIME on NETWORK "
-         example: "Sunday 9:00 PM on HBO " */
-      for (p = tagline, q = s->day; *p != ' '; ++q, ++p)
-        *q = *p;
-      *q = '\0';
-      while (*p == ' ')
-        p++;
-      for (q = s->time; *p != ' '; ++q, ++p)
-        *q = *p;
-      *q = ' ';
-      while (*p == ' ')
-        p++;
-      for (q++; *p != ' '; ++q, ++p)
-        *q = *p;
-      *q = '\0';
-      while (*p == ' ')
-        p++;
-      if (*p == 'o' && *(p + 1) == 'n')
-        p += 2;
-      while (*p == ' ')
-        p++;
-      for (q = s->network; *p && *p != ' '; ++q, ++p)
-        *q = *p;
-      *q = '\0';
+      status = curl_multi_wait (mp, NULL, 0, MULTI_WAIT_TIMEOUT, NULL);
+      if (status != CURLM_OK)
+        tvi_die (E_INTERNET, "libcurl error: %s",
+                 curl_multi_strerror (status));
     }
   }
+
+  progress_finish ();
+  curl_multi_cleanup (mp);
 }
 
 static void
-spec_append (struct spec *s, int value)
+page_fetch_done (struct fetch *f)
 {
-  s->v[s->n++] = value;
+  buffer_put (&page);
+  page = f->page;
+  f->page.buffer = NULL;
+  f->page.n = 0;
+  f->page.size = 0;
 }
 
-static bool
-spec_parse_from_optarg (struct spec *s, char *arg)
+/* Leaves the page in F for the caller of fetch_all() to pick up. */
+static void
+page_fetch_keep (struct fetch *f)
 {
-  char *p;
-
-  for (p = arg; *p; ++p)
-    if (!isdigit (*p) && *p != SPEC_DELIM_C)
-      return false;
-
-  for (p = strtok (arg, SPEC_DELIM_S); p; p = strtok (NULL, SPEC_DELIM_S))
-    spec_append (s, (int) strtoll (p, (char **) NULL, 10));
-  return true;
+  (void) f;
 }
 
-static bool
-spec_contains (const struct spec *s, int value)
+static void
+init_page_fetch (struct fetch *f,
+                 struct page_matcher *m,
+                 const char *url,
+                 int type)
 {
-  int i;
-
-  for (i = 0; i < s->n; ++i)
-    if (s->v[i] == value)
-      return true;
-  return false;
+  init_fetch (f, type);
+  snprintf (f->url, TVI_BUFMAX, "%s", url);
+  init_page_matcher (m, type);
+  if (m->n_fields > 0)
+    f->matcher = m;
 }
 
+/* Retrieves a single page into the global page buffer. */
 static void
-parse_episodes_page (void)
+fetch_page (const char *url, int type, const struct tvi_options *x)
 {
-  int i;
-  char *p;
-
-  parse_series_proper_title ();
-  parse_series_description ();
-  parse_series_schedule ();
+  struct fetch f;
+  struct page_matcher m;
 
-  for (i = 1;; ++i)
-  {
-    season_pattern (s, i);
-    p = strstr (page.buffer, html_pattern_s);
-    if (!p)
-      break;
-    series.total_seasons++;
-  }
+  init_page_fetch (&f, &m, url, type);
+  fetch_all (&f, 1, &page_fetch_done, x);
 }
 
-static void
-init_series (void)
+/* Named character references, placed by entity_hash() of their names so
+   a lookup is a single probe. The table was laid out offline by trying
+   seeds until no two names shared a slot; names added to it need a seed
+   that keeps it that way. */
+static const struct
 {
-  series.total_episodes = 0;
-  series.total_seasons = 0;
-
-  series.rating = -1.0f;
-
-  series.schedule.ended = false;
-  series.schedule.day[0] = '\0';
-  series.schedule.time[0] = '\0';
-  series.schedule.network[0] = '\0';
-
-  series.air_start[0] = '\0';
-  series.air_end[0] = '\0';
-
-  series.title.proper[0] = '\0';
-  series.title.url[0] = '\0';
-  series.title.given = NULL;
-
-  series.cast.total_people = 0;
-
-  series.description = NULL;
+  const char *name;
+  const char *utf8;
 }
+entities[ENTITY_HASH_SIZE] =
+{
+  [1] = {"laquo", "\xc2\xab"},
+  [4] = {"ldquo", "\xe2\x80\x9c"},
+  [9] = {"cent", "\xc2\xa2"},
+  [10] = {"iuml", "\xc3\xaf"},
+  [12] = {"sbquo", "\xe2\x80\x9a"},
+  [16] = {"euro", "\xe2\x82\xac"},
+  [24] = {"hellip", "\xe2\x80\xa6"},
+  [30] = {"ccedil", "\xc3\xa7"},
+  [34] = {"Auml", "\xc3\x84"},
+  [42] = {"amp", "&"},
+  [45] = {"nbsp", " "},
+  [49] = {"euml", "\xc3\xab"},
+  [59] = {"oacute", "\xc3\xb3"},
+  [67] = {"middot", "\xc2\xb7"},
+  [68] = {"ocirc", "\xc3\xb4"},
+  [81] = {"ntilde", "\xc3\xb1"},
+  [85] = {"rdquo", "\xe2\x80\x9d"},
+  [90] = {"rsquo", "\xe2\x80\x99"},
+  [94] = {"uuml", "\xc3\xbc"},
+  [96] = {"frac12", "\xc2\xbd"},
+  [101] = {"Ouml", "\xc3\x96"},
+  [115] = {"agrave", "\xc3\xa0"},
+  [117] = {"GT", ">"},
+  [123] = {"ecirc", "\xc3\xaa"},
+  [135] = {"lt", "<"},
+  [137] = {"pound", "\xc2\xa3"},
+  [143] = {"egrave", "\xc3\xa8"},
+  [147] = {"reg", "\xc2\xae"},
+  [149] = {"gt", ">"},
+  [161] = {"oslash", "\xc3\xb8"},
+  [162] = {"auml", "\xc3\xa4"},
+  [164] = {"trade", "\xe2\x84\xa2"},
+  [165] = {"times", "\xc3\x97"},
+  [167] = {"LT", "<"},
+  [173] = {"acirc", "\xc3\xa2"},
+  [177] = {"lsquo", "\xe2\x80\x98"},
+  [181] = {"Aacute", "\xc3\x81"},
+  [187] = {"quot", "\""},
+  [188] = {"iacute", "\xc3\xad"},
+  [189] = {"QUOT", "\""},
+  [196] = {"copy", "\xc2\xa9"},
+  [202] = {"aring", "\xc3\xa5"},
+  [204] = {"ouml", "\xc3\xb6"},
+  [215] = {"uacute", "\xc3\xba"},
+  [218] = {"eacute", "\xc3\xa9"},
+  [221] = {"apos", "'"},
+  [222] = {"Uuml", "\xc3\x9c"},
+  [223] = {"szlig", "\xc3\x9f"},
+  [227] = {"bull", "\xe2\x80\xa2"},
+  [231] = {"AMP", "&"},
+  [234] = {"raquo", "\xc2\xbb"},
+  [236] = {"Eacute", "\xc3\x89"},
+  [242] = {"ndash", "\xe2\x80\x93"},
+  [245] = {"deg", "\xc2\xb0"},
+  [247] = {"mdash", "\xe2\x80\x94"},
+  [249] = {"bdquo", "\xe2\x80\x9e"},
+  [251] = {"aacute", "\xc3\xa1"},
+};
 
-static void
-init_season (struct season *season)
+static unsigned int
+entity_hash (const char *s, size_t n)
 {
-  season->total_episodes = 0;
-  season->rating = -1.0f;
+  size_t i;
+  uint32_t h;
+
+  h = ENTITY_HASH_SEED;
+  for (i = 0; i < n; ++i)
+    h = (h ^ (unsigned char) s[i]) * ENTITY_HASH_PRIME;
+  return h >> 24;
 }
 
-static void
-init_episode (struct episode *episode)
+static int
+utf8_encode (unsigned long c, char *out)
 {
-  episode->has_aired = false;
-  episode->rating = 0.0f;
-  episode->title[0] = '\0';
-  episode->air[0] = '\0';
-  episode->description = NULL;
+  if (c < 0x80)
+  {
+    out[0] = (char) c;
+    return 1;
+  }
+  if (c < 0x800)
+  {
+    out[0] = (char) (0xc0 | (c >> 6));
+    out[1] = (char) (0x80 | (c & 0x3f));
+    return 2;
+  }
+  if (c < 0x10000)
+  {
+    out[0] = (char) (0xe0 | (c >> 12));
+    out[1] = (char) (0x80 | ((c >> 6) & 0x3f));
+    out[2] = (char) (0x80 | (c & 0x3f));
+    return 3;
+  }
+  out[0] = (char) (0xf0 | (c >> 18));
+  out[1] = (char) (0x80 | ((c >> 12) & 0x3f));
+  out[2] = (char) (0x80 | ((c >> 6) & 0x3f));
+  out[3] = (char) (0x80 | (c & 0x3f));
+  return 4;
 }
 
-static void
-parse_episode_title (struct episode *episode, char **secp)
+/* Decodes the character reference at *S (which starts with '&' and ends
+   at END at the latest) to UTF-8 in OUT and moves *S past it. Returns the
+   number of bytes written, at most 4 and never more than the reference
+   took up, or 0 if *S does not start a reference. No-break spaces become
+   plain spaces so descriptions can still be wrapped at them. */
+static int
+decode_entity (const char **s, const char *end, char *out)
 {
-  ssize_t p;
-  char *t;
-  char *q;
+  int base;
+  int k;
+  unsigned int h;
+  unsigned long c;
+  const char *d;
+  const char *p;
 
-  for (p = *secp - page.buffer; p >= 0; --p)
+  p = *s + 1;
+  if (p < end && *p == '#')
   {
-    if (page.buffer[p] == '<' &&
-        page.buffer[p + 1] == '/' &&
-        page.buffer[p + 2] == 'a' &&
-        page.buffer[p + 3] == '>')
+    base = 10;
+    if (++p < end && (*p == 'x' || *p == 'X'))
     {
-      for (p--; page.buffer[p] != '>'; --p)
-        ;
-      for (t = episode->title, q = page.buffer + (p + 1); *q != '<'; ++t, ++q)
-        *t = *q;
-      *t = '\0';
-      break;
+      base = 16;
+      p++;
     }
+    for (c = 0, d = p; d < end && d - p < ((base == 10) ? 7 : 6); ++d)
+    {
+      if (isdigit ((unsigned char) *d))
+        k = *d - '0';
+      else if (base == 16 && isxdigit ((unsigned char) *d))
+        k = tolower ((unsigned char) *d) - 'a' + 10;
+      else
+        break;
+      c = c * base + k;
+    }
+    if (d == p || d >= end || *d != ';')
+      return 0;
+    if (c == 0 || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+      c = 0xfffd;
+    else if (c == 0xa0)
+      c = ' ';
+    *s = d + 1;
+    return utf8_encode (c, out);
   }
+
+  for (d = p; d < end && d - p < ENTITY_NAME_MAX &&
+       isalnum ((unsigned char) *d); ++d)
+    ;
+  if (d == p || d >= end || *d != ';')
+    return 0;
+  h = entity_hash (p, d - p);
+  if (!entities[h].name || strncmp (entities[h].name, p, d - p) != 0 ||
+      entities[h].name[d - p])
+    return 0;
+  *s = d + 1;
+  k = strlen (entities[h].utf8);
+  memcpy (out, entities[h].utf8, k);
+  return k;
 }
 
 static void
-parse_episode_air (struct episode *episode, char **secp)
+set_url_title_best_guess (void)
 {
-  char *a;
-  char *p;
+  char *g;
+  char *u;
 
-  p = strstr (*secp, EPISODE_AIR_PATTERN);
-  if (p && *p)
+  for (g = series.title.given, u = series.title.url; *g; ++g, ++u)
   {
-    p += n_episode_air_pattern;
-    for (a = episode->air; *p != '<'; ++a, ++p)
-      *a = *p;
-    *a = '\0';
+    if (*g == '\'' || *g == ':' || *g == '.' || *g == ' ')
+    {
+      if (*g == ' ')
+        *u = '-';
+      continue;
+    }
+    *u = *g;
   }
+  *u = '\0';
+
+  tvi_debug ("guessed URL title for \"%s\": \"%s\"",
+             series.title.given, series.title.url);
 }
 
+/* Finds every marker of a page of type TYPE in PAGE in one pass, for the
+   field parsers to look up with page_mark(). */
 static void
-parse_episode_rating (struct episode *episode, char **secp)
+mark_page (int type)
 {
-  char buffer[TVI_BUFMAX];
-  char *r;
-  char *p;
+  int id;
+  const struct scanner *s;
+  struct scan_cursor c = SCAN_CURSOR_INIT;
 
-  buffer[0] = '\0';
-  p = strstr (*secp, EPISODE_RATING_PATTERN);
+  s = &scanners[type];
+  memset (marks.n, 0, sizeof (marks.n));
+  while ((id = scanner_next (s, &c, page.buffer, page.n)) >= 0)
+  {
+    if (marks.n[id] == marks.size[id])
+    {
+      marks.size[id] = marks.size[id] ? marks.size[id] * 2 : 16;
+      marks.at[id] = tvi_renewa (size_t, marks.at[id], marks.size[id]);
+    }
+    marks.at[id][marks.n[id]++] = c.offset - s->length[id];
+  }
+}
 
-  if (p && *p)
+/* Returns the first marker ID in PAGE at or after FROM, or NULL. */
+static char *
+page_mark (int id, const char *from)
+{
+  size_t hi;
+  size_t lo;
+  size_t mid;
+  size_t offset;
+
+  if (!from)
+    return NULL;
+  offset = from - page.buffer;
+  lo = 0;
+  hi = marks.n[id];
+  while (lo < hi)
   {
-    p += n_episode_rating_pattern;
-    for (; *p != '>'; ++p)
-      ;
-    for (p++, r = buffer; *p != '<'; ++r, ++p)
-      *r = *p;
-    *r = '\0';
+    mid = lo + (hi - lo) / 2;
+    if (marks.at[id][mid] < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+  return (lo < marks.n[id]) ? page.buffer + marks.at[id][lo] : NULL;
+}
+
+/* Returns the first C in the text from P to END, or END if there is
+   none. */
+static const char *
+find_c (const char *p, const char *end, int c)
+{
+  const char *q;
 
-  if (*buffer)
-    episode->rating = strtod (buffer, (char **) NULL);
+  q = memchr (p, c, end - p);
+  return q ? q : end;
 }
 
-static void
-parse_episode_description (struct episode *episode, char **secp)
+/* Copies the text from P to END to D, decoding the entity references in
+   it. Returns the number of bytes written, which is never more than the
+   text took up. */
+static size_t
+decode_text (char *d, const char *p, const char *end)
 {
-  bool end;
+  int k;
   size_t n;
-  char *d;
-  char *p;
+  size_t run;
 
   n = 0;
-  p = strstr (*secp, EPISODE_DESCRIPTION_PATTERN);
-
-  if (p && *p)
+  while (p < end)
   {
-    p += n_episode_description_pattern;
-    if (*p == '<' && *(p + 1) == '/')
-    {
-      episode->description = tvi_strdup (EMPTY_DESCRIPTION, -1);
-      return;
-    }
-    for (;;)
-    {
-      if (*p == '<' || *p == '>' || isspace (*p))
-      {
-        if (*p == '<')
-          while (*p != '>')
-            p++;
-        else
-          p++;
-        continue;
-      }
+    run = find_c (p, end, '&') - p;
+    memcpy (d + n, p, run);
+    n += run;
+    p += run;
+    if (p == end)
       break;
-    }
-    for (; *p; ++p, ++n)
-    {
-      end = false;
-      while (*p == '<')
-      {
-        if (*(p + 1) == '/')
-        {
-          end = true;
-          break;
-        }
-        while (*p != '>')
-          p++;
-        if (*p == '>')
-          p++;
-      }
-      if (end)
-        break;
-    }
+    k = decode_entity (&p, end, d + n);
+    if (k > 0)
+      n += k;
+    else
+      d[n++] = *p++;
   }
+  return n;
+}
+
+/* Copies the text from P to END to the arena A and returns a view of it.
+   Entity references are decoded on the way, if the text has any. */
+static struct tvi_str
+arena_text (struct tvi_arena *a, const char *p, const char *end)
+{
+  char *d;
+  struct tvi_str v;
+
+  if (p >= end)
+    return no_text;
+  if (!memchr (p, '&', end - p))
+    return tvi_arena_str (a, p, end - p);
+
+  /* decoding never makes the text longer */
+  d = tvi_arena_reserve (a, end - p + 1);
+  v.n = decode_text (d, p, end);
+  d[v.n] = '\0';
+  v.s = tvi_arena_commit (a, v.n + 1);
+  return v;
+}
+
+static struct tvi_str
+series_text (const char *p, const char *end)
+{
+  return arena_text (&series.strings, p, end);
+}
 
-  episode->description = tvi_newa (char, n + 1);
-  p = strstr (*secp, EPISODE_DESCRIPTION_PATTERN);
+/* Finds the first text after P in a page (in a tag if IN_TAG) and sets
+   the name of TOKEN to it. A closing tag that comes first makes the text
+   empty. Returns false if END comes first and more of the page is still
+   to come. */
+static bool
+page_text (const char *p,
+           const char *end,
+           bool last,
+           bool in_tag,
+           struct html_token *token)
+{
+  int type;
+  struct html_tokenizer t;
 
-  if (p && *p)
+  html_init (&t, p, end, last, in_tag);
+  for (;;)
   {
-    p += n_episode_description_pattern;
-    for (;;)
-    {
-      if (*p == '<' || *p == '>' || isspace (*p))
-      {
-        if (*p == '<')
-          while (*p != '>')
-            p++;
-        else
-          p++;
-        continue;
-      }
-      break;
-    }
-    for (d = episode->description; *p; ++d, ++p)
+    type = html_next (&t, token);
+    if (type == HTML_TEXT)
+      return true;
+    if (type == HTML_MORE)
+      return false;
+    if (type == HTML_END || type == HTML_TAG_CLOSE)
     {
-      end = false;
-      while (*p == '<')
-      {
-        if (*(p + 1) == '/')
-        {
-          end = true;
-          break;
-        }
-        while (*p != '>')
-          p++;
-        if (*p == '>')
-          p++;
-      }
-      if (end)
-        break;
-      while (is_entity_ref (p))
-        *d++ = entity_ref_char (&p);
-      *d = *p;
+      token->name = t.p;
+      token->n_name = 0;
+      return true;
     }
-    *d = '\0';
   }
-
-  if (!episode->description || !*episode->description)
-    tvi_debug ("failed to parse episode description (\"%s\")",
-               episode->title);
 }
 
-static void
-set_episode_has_aired (struct episode *episode)
+/* Finds attribute NAME of the tag of PAGE that P is in, from P on, and
+   fills in TOKEN with it. Returns false if the tag does not have it. */
+static bool
+page_attribute (const char *p, const char *name, struct html_token *token)
 {
   size_t n;
-  time_t a;
-  char buffer[TVI_BUFMAX];
-  struct tm tm;
-  char *t;
+  struct html_tokenizer t;
 
-  n = strlen (episode->air);
-  memcpy (buffer, episode->air, n + 1);
-  t = series.schedule.time;
-  if (*t && strchr (t, ':'))
-    memcpy (buffer + n, t, strlen (t) + 1);
+  n = strlen (name);
+  html_init (&t, p, page.buffer + page.n, true, true);
+  while (t.in_tag && html_next (&t, token) == HTML_ATTRIBUTE)
+    if (token->n_name == n && tvi_strncasecmp (token->name, name, n) == 0)
+      return true;
+  return false;
+}
 
-  memset (&tm, 0, sizeof (struct tm));
-  strptime (buffer, "%m/%d/%y %I:%M %p", &tm);
+/* Returns true if the URL title was found on the search page, false if
+   it had to be guessed. */
+static bool
+parse_search_page (void)
+{
+  size_t n;
+  char *h;
+  char *p;
+  const char *u;
+  struct html_token token;
 
-  a = mktime (&tm);
-  if (a == -1)
+  mark_page (PAGE_SEARCH);
+  p = page_mark (MARK_SEARCH_SHOW, page.buffer);
+  h = p ? page_mark (MARK_SEARCH_HREF, p) : NULL;
+  if (h && page_attribute (h, "href", &token))
   {
-    tvi_error (0, "failed to get time value from air date/time \"%s\"",
-               buffer);
-    return;
-  }
+    /* the link is to "/shows/URL_TITLE/" */
+    u = h + n_search_href_pattern;
+    n = find_c (u, token.value + token.n_value, '/') - u;
+    if (n < TVI_BUFMAX)
+    {
+      memcpy (series.title.url, u, n);
+      series.title.url[n] = '\0';
+    }
+  }
+
+  if (!*series.title.url)
+  {
+    tvi_debug ("failed to parse title for URL; guessing...");
+    set_url_title_best_guess ();
+    return false;
+  }
+  return true;
+}
+
+/* Turns the given title into the key it is kept under in the title index:
+   lower case, with every run of other characters than letters and digits
+   made into a single space (so "The Wire", "the wire" and "the-wire" are
+   all "the wire"). */
+static void
+title_index_key (char *key)
+{
+  bool space;
+  char *k;
+  const char *g;
+
+  space = false;
+  for (g = series.title.given, k = key; *g && k < key + TVI_BUFMAX - 1; ++g)
+  {
+    if (isalnum ((unsigned char) *g))
+    {
+      if (space && k > key)
+        *k++ = ' ';
+      *k++ = tolower ((unsigned char) *g);
+      space = false;
+    }
+    else
+      space = true;
+  }
+  *k = '\0';
+}
+
+/* Looks the given title up in the title index, which saves searching for
+   shows that have been looked up before. */
+static bool
+lookup_title_index (const struct tvi_options *x)
+{
+  char key[TVI_BUFMAX];
+
+  if (!x->use_cache || x->refresh)
+    return false;
+
+  title_index_key (key);
+  if (!*key || !cache_map_get (TITLE_INDEX, key, series.title.url, TVI_BUFMAX))
+    return false;
+
+  tvi_debug ("found URL title for \"%s\" in index: \"%s\"",
+             series.title.given, series.title.url);
+  return true;
+}
+
+static void
+update_title_index (const struct tvi_options *x)
+{
+  char key[TVI_BUFMAX];
+
+  if (!x->use_cache)
+    return;
+
+  title_index_key (key);
+  if (*key)
+    cache_map_put (TITLE_INDEX, key, series.title.url);
+}
+
+static void
+parse_series_proper_title (void)
+{
+  const char *p;
+  const char *q;
+  struct html_token token;
+
+  series.title.proper = no_text;
+  p = page_mark (MARK_SERIES_TITLE, page.buffer);
+
+  if (p && page_text (p, page.buffer + page.n, true, false, &token))
+  {
+    /* the title of the page is "PROPER TITLE - ..." */
+    p = token.name;
+    q = find_c (p, p + token.n_name, '-');
+    while (q > p && q[-1] == ' ')
+      q--;
+    series.title.proper = series_text (p, q);
+  }
+
+  if (!series.title.proper.n)
+    tvi_debug ("failed to parse proper title");
+}
+
+static void
+parse_series_description (void)
+{
+  const char *p;
+  struct html_token token;
+
+  p = page_mark (MARK_SERIES_DESCRIPTION, page.buffer);
+  if (!p || !page_attribute (p, "content", &token) || token.n_value == 0)
+  {
+    series.description =
+      tvi_arena_strdup (&series.strings, EMPTY_DESCRIPTION, -1);
+    return;
+  }
+
+  series.description =
+    series_text (token.value, token.value + token.n_value).s;
+  if (!*series.description)
+    tvi_debug ("failed to parse series description");
+}
+
+static void
+parse_series_schedule (void)
+{
+  const char *e;
+  const char *end;
+  const char *p;
+  const char *q;
+  struct html_token token;
+  struct schedule *s = &series.schedule;
+
+  p = page_mark (MARK_SERIES_TAGLINE, page.buffer);
+  if (!p || !page_text (p, page.buffer + page.n, true, true, &token))
+    return;
+
+  p = token.name;
+  end = p + token.n_name;
+  for (e = p; e + n_tagline_ended <= end; ++e)
+    if (memcmp (e, TAGLINE_ENDED, n_tagline_ended) == 0)
+      break;
+
+  if (e + n_tagline_ended <= end)
+  {
+    /* tagline will be of the form:
+         "NETWORK (ended YEAR)"
+       example: "AMC (ended 2013)" */
+    s->ended = true;
+    s->network = series_text (p, find_c (p, end, ' '));
+    for (e += n_tagline_ended; e < end && *e == ' '; ++e)
+      ;
+    s->time = series_text (e, find_c (e, end, ')'));
+  }
+  else
+  {
+    /* tagline will be of the form:
+         "DAY TIME on NETWORK "
+       example: "Sunday 9:00 PM on HBO " */
+    q = find_c (p, end, ' ');
+    s->day = series_text (p, q);
+    for (p = q; p < end && *p == ' '; ++p)
+      ;
+    /* TIME is two words, the clock time and AM or PM */
+    q = find_c (p, end, ' ');
+    while (q < end && *q == ' ')
+      q++;
+    q = find_c (q, end, ' ');
+    s->time = series_text (p, q);
+    for (p = q; p < end && *p == ' '; ++p)
+      ;
+    if (end - p >= 2 && p[0] == 'o' && p[1] == 'n')
+      p += 2;
+    while (p < end && *p == ' ')
+      p++;
+    s->network = series_text (p, find_c (p, end, ' '));
+  }
+}
+
+static void
+spec_append (struct spec *s, int value)
+{
+  if (s->n == s->size)
+  {
+    s->size = s->size ? s->size * 2 : 16;
+    s->v = tvi_renewa (int, s->v, s->size);
+  }
+  s->v[s->n++] = value;
+}
+
+static bool
+spec_parse_from_optarg (struct spec *s, char *arg)
+{
+  char *p;
+
+  for (p = arg; *p; ++p)
+    if (!isdigit (*p) && *p != SPEC_DELIM_C)
+      return false;
+
+  for (p = strtok (arg, SPEC_DELIM_S); p; p = strtok (NULL, SPEC_DELIM_S))
+    spec_append (s, (int) strtoll (p, (char **) NULL, 10));
+  return true;
+}
+
+static bool
+spec_contains (const struct spec *s, int value)
+{
+  int i;
+
+  for (i = 0; i < s->n; ++i)
+    if (s->v[i] == value)
+      return true;
+  return false;
+}
+
+static bool
+ttl_parse_value (time_t *ttl, const char *arg)
+{
+  long long n;
+  char *end;
+
+  n = strtoll (arg, &end, 10);
+  if (end == arg || n < 0)
+    return false;
+
+  switch (*end)
+  {
+    case '\0':
+    case 's':
+      break;
+    case 'm':
+      n *= SECONDS_PER_MINUTE;
+      break;
+    case 'h':
+      n *= SECONDS_PER_HOUR;
+      break;
+    case 'd':
+      n *= SECONDS_PER_DAY;
+      break;
+    default:
+      return false;
+  }
+
+  if (*end && *(end + 1))
+    return false;
+  *ttl = (time_t) n;
+  return true;
+}
+
+static bool
+ttl_parse_from_optarg (time_t *ttl, char *arg)
+{
+  int i;
+  char *p;
+  char *v;
+
+  for (p = strtok (arg, SPEC_DELIM_S); p; p = strtok (NULL, SPEC_DELIM_S))
+  {
+    v = strchr (p, TTL_DELIM_C);
+    if (!v)
+      return false;
+    *v++ = '\0';
+    for (i = 0; i < PAGE_TYPES; ++i)
+      if (strcmp (p, page_type_names[i]) == 0)
+        break;
+    if (i == PAGE_TYPES || !ttl_parse_value (&ttl[i], v))
+      return false;
+  }
+  return true;
+}
+
+static bool
+count_parse_from_optarg (int *count, const char *arg)
+{
+  long n;
+  char *end;
+
+  n = strtol (arg, &end, 10);
+  if (end == arg || *end || n <= 0 || n > INT_MAX)
+    return false;
+  *count = (int) n;
+  return true;
+}
+
+/* Reads the season list of the episodes page from the season markers
+   found in it. Every entry starts with SEASON_MARKER and the season
+   number, and may give the number of episodes before the next entry
+   starts. The seasons of the series are the ones listed from 1 up to the
+   first gap, so with N entries in the list no season past N can be one of
+   them. */
+static void
+parse_season_list (void)
+{
+  int v;
+  size_t i;
+  char *c;
+  char *d;
+  char *p;
+  char *q;
+  struct html_token token;
+  struct season_entry *entry;
+
+  series.listing = tvi_arena_newa (&series.strings, struct season_entry,
+                                   marks.n[MARK_SEASON]);
+  for (i = 0; i < marks.n[MARK_SEASON]; ++i)
+  {
+    p = page.buffer + marks.at[MARK_SEASON][i];
+    q = (i + 1 < marks.n[MARK_SEASON]) ?
+        page.buffer + marks.at[MARK_SEASON][i + 1] : NULL;
+    d = p + strlen (SEASON_MARKER);
+    for (v = 0; isdigit (*d) && (size_t) v <= marks.n[MARK_SEASON]; ++d)
+      v = v * 10 + (*d - '0');
+    if (v < 1 || (size_t) v > marks.n[MARK_SEASON] ||
+        series.listing[v - 1].listed)
+      continue;
+
+    entry = &series.listing[v - 1];
+    entry->listed = true;
+    entry->episodes = -1;
+    entry->offset = p - page.buffer;
+
+    c = page_mark (MARK_SEASON_COUNT, d);
+    if (c && (!q || c < q) &&
+        page_text (c, page.buffer + page.n, true, true, &token) &&
+        token.n_name > 0 && isdigit ((unsigned char) *token.name))
+      entry->episodes = (int) strtol (token.name, (char **) NULL, 10);
+  }
+
+  while ((size_t) series.total_seasons < marks.n[MARK_SEASON] &&
+         series.listing[series.total_seasons].listed)
+    series.total_seasons++;
+  series.season = tvi_arena_newa (&series.strings, struct season,
+                                  series.total_seasons);
+  tvi_debug ("%i seasons listed", series.total_seasons);
+}
+
+static void
+parse_episodes_page (void)
+{
+  mark_page (PAGE_EPISODES);
+  parse_series_proper_title ();
+  parse_series_description ();
+  parse_series_schedule ();
+  parse_season_list ();
+}
+
+static void
+init_series (void)
+{
+  series.loaded = 0;
+  series.total_episodes = 0;
+  series.total_seasons = 0;
+
+  series.rating = -1.0f;
+
+  series.schedule.ended = false;
+  series.schedule.day = no_text;
+  series.schedule.time = no_text;
+  series.schedule.network = no_text;
+
+  series.air_start = no_text;
+  series.air_end = no_text;
+
+  series.title.proper = no_text;
+  series.title.url[0] = '\0';
+  series.title.given = NULL;
+
+  series.cast.total_people = 0;
+  series.cast.person = NULL;
+
+  series.season = NULL;
+  series.listing = NULL;
+  memset (&series.columns, 0, sizeof (series.columns));
+  series.description = NULL;
+  series.strings.head = NULL;
+}
+
+static void
+init_season (struct season *season)
+{
+  season->total_episodes = 0;
+  season->rating = -1.0f;
+  season->episode = NULL;
+}
+
+static void
+init_episode (struct episode *episode)
+{
+  episode->has_aired = false;
+  episode->rating = 0.0f;
+  episode->air_time = 0;
+  episode->title = no_text;
+  episode->air = no_text;
+  episode->description = NULL;
+}
+
+/* Returns the number of days from 1970-01-01 to day D of month M (1-12)
+   of year Y. D may be 0 or past the end of the month, which counts from
+   the first of the month all the same. */
+static int64_t
+days_from_civil (int64_t y, int m, int d)
+{
+  int64_t era;
+  int64_t yoe;
+  int64_t doy;
+
+  y -= m <= 2;
+  era = ((y >= 0) ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + ((m > 2) ? -3 : 9)) + 2) / 5 + d - 1;
+  return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+/* Returns the seconds from the epoch to what the clock in TM reads, as
+   if it were a clock of UTC. */
+static int64_t
+tm_seconds (const struct tm *tm)
+{
+  return days_from_civil (tm->tm_year + 1900, tm->tm_mon + 1,
+                          tm->tm_mday) * 86400 +
+         tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
+
+/* Takes the time of the run and how far local time is off UTC at it, so
+   that air times can be worked out without going through the time zone
+   rules for every one of them. Episodes near enough to the time of the
+   run for it to matter whether they have aired share its offset. */
+static void
+init_air_clock (void)
+{
+  time_t t;
+  struct tm tm;
+
+  t = time (NULL);
+  air_clock_now = t;
+  utc_offset = 0;
+  if (localtime_r (&t, &tm))
+    utc_offset = tm_seconds (&tm) - t;
+}
+
+/* Reads a number at *P (after any white space) into V the way strptime()
+   does: no more digits are taken than fit under HI, and the number has
+   to be from LO to HI. */
+static bool
+air_number (const char **p, int lo, int hi, int *v)
+{
+  const char *q;
+
+  for (q = *p; isspace ((unsigned char) *q); ++q)
+    ;
+  if (!isdigit ((unsigned char) *q))
+    return false;
+  for (*v = 0; isdigit ((unsigned char) *q) && *v * 10 <= hi; ++q)
+    *v = *v * 10 + (*q - '0');
+  if (*v < lo || *v > hi)
+    return false;
+  *p = q;
+  return true;
+}
+
+/* Fills in TM from an air DATE of the form "M/D/YY" and the clock TIME of
+   the schedule ("H:MM AM"), if it has one, the way strptime() would with
+   "%m/%d/%y %I:%M %p". Reading stops at the first field that does not
+   fit, leaving the rest of TM as it is. */
+static void
+read_air_time (struct tm *tm, const char *date, const char *time)
+{
+  int v;
+  const char *p;
+
+  p = date;
+  if (!air_number (&p, 1, 12, &v))
+    return;
+  tm->tm_mon = v - 1;
+  if (*p++ != '/' || !air_number (&p, 1, 31, &v))
+    return;
+  tm->tm_mday = v;
+  if (*p++ != '/' || !air_number (&p, 0, 99, &v))
+    return;
+  tm->tm_year = (v < 69) ? v + 100 : v;
+
+  while (isspace ((unsigned char) *p))
+    p++;
+  if (*p || !strchr (time, ':'))
+    return;
+  p = time;
+  if (!air_number (&p, 1, 12, &v))
+    return;
+  tm->tm_hour = v % 12;
+  if (*p++ != ':' || !air_number (&p, 0, 59, &v))
+    return;
+  tm->tm_min = v;
+  while (isspace ((unsigned char) *p))
+    p++;
+  if (tvi_strncasecmp (p, "PM", 2) == 0)
+    tm->tm_hour += 12;
+}
+
+/* Returns when EPISODE airs, in seconds since the epoch. */
+static int64_t
+episode_air_time (const struct episode *episode)
+{
+  struct tm tm;
+
+  memset (&tm, 0, sizeof (struct tm));
+  read_air_time (&tm, episode->air.s, series.schedule.time.s);
+  return tm_seconds (&tm) - utc_offset;
+}
+
+static void
+set_episode_has_aired (struct episode *episode)
+{
+  episode->air_time = episode_air_time (episode);
+  episode->has_aired = episode->air_time < air_clock_now;
+  if (!episode->has_aired)
+    episode->rating = -1.0f;
+}
+
+/* Lays the episodes of the seasons that are in out in columns. */
+static void
+build_episode_columns (void)
+{
+  int e;
+  int i;
+  int n;
+  int s;
+  const struct episode *episode;
+  struct episode_columns *c = &series.columns;
+
+  for (n = 0, s = 0; s < series.total_seasons; ++s)
+    n += SEASON (s).total_episodes;
+  if (n > c->size)
+  {
+    c->size = n;
+    c->rating = tvi_renewa (double, c->rating, n);
+    c->air_time = tvi_renewa (int64_t, c->air_time, n);
+    c->season = tvi_renewa (int, c->season, n);
+    c->aired = tvi_renewa (uint64_t, c->aired, (n + 63) / 64);
+  }
+  c->first = tvi_renewa (int, c->first, series.total_seasons + 1);
+  if (n > 0)
+    memset (c->aired, 0, ((n + 63) / 64) * sizeof (uint64_t));
+
+  for (i = 0, s = 0; s < series.total_seasons; ++s)
+  {
+    c->first[s] = i;
+    for (e = 0; e < SEASON (s).total_episodes; ++e, ++i)
+    {
+      episode = &EPISODE (SEASON (s), e);
+      c->rating[i] = episode->rating;
+      c->air_time[i] = episode->air_time;
+      c->season[i] = s;
+      if (episode->has_aired)
+        c->aired[i / 64] |= UINT64_C (1) << (i % 64);
+    }
+  }
+  c->first[s] = i;
+  c->n = n;
+}
+
+static void
+free_episode_columns (void)
+{
+  struct episode_columns *c = &series.columns;
+
+  tvi_free (c->rating);
+  tvi_free (c->air_time);
+  tvi_free (c->season);
+  tvi_free (c->aired);
+  tvi_free (c->first);
+}
+
+/* Sets the rating of season S to the average rating of its episodes that
+   have aired, from the columns. */
+static void
+set_season_rating (int s)
+{
+  int i;
+  int total;
+  double x;
+  const struct episode_columns *c = &series.columns;
+
+  total = 0;
+  x = 0.0;
+  for (i = c->first[s]; i < c->first[s + 1]; ++i)
+  {
+    if (COLUMN_AIRED (c, i))
+    {
+      total++;
+      x += c->rating[i];
+    }
+  }
+  SEASON (s).rating = x / total;
+}
+
+/* Compares the text at P (which ends at END) with S, of length N. Returns
+   1 if S is there, 0 if it is not and -1 if END cuts the text short while
+   it still matches. */
+static int
+match_at (const char *p, const char *end, const char *s, size_t n)
+{
+  size_t k;
+
+  k = ((size_t) (end - p) < n) ? (size_t) (end - p) : n;
+  if (memcmp (p, s, k) != 0)
+    return 0;
+  return (k == n) ? 1 : -1;
+}
+
+/* Makes room in the season SP fills in for episode NO. Episodes that run
+   out of room are moved to a block at least twice as big; the one they
+   leave behind goes with the arena. */
+static void
+season_parser_grow (struct season_parser *sp, int no)
+{
+  int size;
+  bool *seen;
+  struct episode *episode;
+
+  if (no <= sp->size)
+    return;
+  for (size = (sp->size > 0) ? sp->size * 2 : SEASON_EPISODES_MIN;
+       size < no; size *= 2)
+    ;
+  episode = tvi_arena_newa (&sp->strings, struct episode, size);
+  seen = tvi_arena_newa (&sp->strings, bool, size);
+  if (sp->size > 0)
+  {
+    memcpy (episode, sp->season->episode, sp->size * sizeof (*episode));
+    memcpy (seen, sp->seen, sp->size * sizeof (*seen));
+  }
+  sp->season->episode = episode;
+  sp->seen = seen;
+  sp->size = size;
+}
+
+/* Sets SP up to fill in SEASON, which is said to have EPISODES episodes
+   (or -1 if nothing is known about it). */
+static void
+season_parser_init (struct season_parser *sp,
+                    struct season *season,
+                    int episodes)
+{
+  sp->season = season;
+  sp->current = NULL;
+  sp->pending.n = 0;
+  sp->pending.size = 0;
+  sp->pending.buffer = NULL;
+  sp->cursor.state = 0;
+  sp->cursor.hits = 0;
+  sp->cursor.offset = 0;
+  sp->mark = -1;
+  sp->fields = 0;
+  sp->title_at = 0;
+  sp->n_title = 0;
+  sp->size = 0;
+  sp->seen = NULL;
+  sp->strings.head = NULL;
+  pthread_mutex_init (&sp->lock, NULL);
+  sp->incoming.n = 0;
+  sp->incoming.size = 0;
+  sp->incoming.buffer = NULL;
+  sp->queued = false;
+  sp->ending = false;
+  init_season (season);
+  season_parser_grow (sp, (episodes > 0) ? episodes : SEASON_EPISODES_MIN);
+}
+
+/* Wraps up the episode being parsed. */
+static void
+season_parser_end_episode (struct season_parser *sp)
+{
+  struct episode *episode;
+
+  episode = sp->current;
+  if (!episode)
+    return;
+
+  set_episode_has_aired (episode);
+  if (!episode->description)
+  {
+    tvi_debug ("failed to parse episode description (\"%s\")",
+               episode->title.s);
+    episode->description = tvi_arena_strdup (&sp->strings, "", -1);
+  }
+  sp->current = NULL;
+}
+
+/* Starts episode NO, whose title is the text of the last link before its
+   marker. Only the first marker of each episode counts. */
+static void
+season_parser_begin_episode (struct season_parser *sp, int no)
+{
+  season_parser_end_episode (sp);
+  season_parser_grow (sp, no);
+  if (sp->seen[no - 1])
+    return;
+  sp->seen[no - 1] = true;
+  sp->current = &sp->season->episode[no - 1];
+  init_episode (sp->current);
+  sp->current->title =
+    arena_text (&sp->strings, sp->pending.buffer + sp->title_at,
+                sp->pending.buffer + sp->title_at + sp->n_title);
+  sp->fields = 0;
+}
+
+/* Parses the description that starts at P: leading tags and white space
+   are skipped, then text is collected (leaving out any tags inside it and
+   decoding entity references) up to the first closing tag. The text is
+   written straight to the top of the string arena, which is made room
+   for one piece of text at a time, and only kept there once it is
+   complete. Returns NULL if END comes first and more of the page is
+   still to come. */
+static const char *
+season_parser_description (struct season_parser *sp,
+                           const char *p,
+                           const char *end,
+                           bool last)
+{
+  int type;
+  size_t n;
+  char *d;
+  const char *q;
+  const char *e;
+  struct html_token token;
+  struct html_tokenizer t;
+
+  d = NULL;
+  n = 0;
+  html_init (&t, p, end, last, false);
+  for (;;)
+  {
+    type = html_next (&t, &token);
+    if (type == HTML_MORE)
+      return NULL;
+    if (type == HTML_END || type == HTML_TAG_CLOSE)
+      break;
+    if (type != HTML_TEXT)
+      continue;
+    q = token.name;
+    e = q + token.n_name;
+    if (n == 0)
+      while (q < e && isspace ((unsigned char) *q))
+        q++;
+    /* decoding never makes the text longer */
+    d = tvi_arena_extend (&sp->strings, d, n, e - q + 1);
+    n += decode_text (d + n, q, e);
+  }
 
-  if (a < time (NULL))
-    episode->has_aired = true;
+  if (n == 0 && type == HTML_TAG_CLOSE)
+  {
+    sp->current->description =
+      tvi_arena_strdup (&sp->strings, EMPTY_DESCRIPTION, -1);
+    return t.p;
+  }
+  d = tvi_arena_extend (&sp->strings, d, n, 1);
+  d[n] = '\0';
+  sp->current->description = tvi_arena_commit (&sp->strings, n + 1);
+  return t.p;
+}
 
-  if (!episode->has_aired)
-    episode->rating = -1.0f;
+/* Handles marker ID of a season page, which ends at P. Returns false if
+   END cuts what comes after it short and more of the page is still to
+   come. */
+static bool
+season_parser_mark (struct season_parser *sp,
+                    int id,
+                    const char *p,
+                    const char *end,
+                    bool last)
+{
+  int m;
+  int v;
+  const char *d;
+  const char *q;
+  struct html_token token;
+
+  switch (id)
+  {
+    case MARK_LINK_END:
+      /* remember the text of every link as the title of the next episode */
+      p -= n_link_end;
+      for (q = p; q > sp->pending.buffer && q[-1] != '>'; --q)
+        ;
+      if (q > sp->pending.buffer)
+      {
+        sp->title_at = q - sp->pending.buffer;
+        sp->n_title = p - q;
+      }
+      return true;
+
+    case MARK_EPISODE:
+      for (d = p, v = 0;
+           d < end && isdigit ((unsigned char) *d) && v <= NUMBER_MAX; ++d)
+        v = v * 10 + (*d - '0');
+      m = match_at (d, end, EPISODE_MARKER_END, n_episode_marker_end);
+      if (m < 0 || d == end)
+        return last;
+      if (m > 0 && d != p && *p != '0' && v <= NUMBER_MAX)
+        season_parser_begin_episode (sp, v);
+      return true;
+
+    case MARK_EPISODE_AIR:
+      if (!sp->current || (sp->fields & EPISODE_HAS_AIR))
+        return true;
+      if (!page_text (p, end, last, false, &token))
+        return false;
+      sp->current->air =
+        arena_text (&sp->strings, token.name, token.name + token.n_name);
+      sp->fields |= EPISODE_HAS_AIR;
+      return true;
+
+    case MARK_EPISODE_DESCRIPTION:
+      if (!sp->current || (sp->fields & EPISODE_HAS_DESCRIPTION))
+        return true;
+      if (!season_parser_description (sp, p, end, last))
+        return false;
+      sp->fields |= EPISODE_HAS_DESCRIPTION;
+      return true;
+
+    case MARK_EPISODE_RATING:
+      if (!sp->current || (sp->fields & EPISODE_HAS_RATING))
+        return true;
+      if (!page_text (p, end, last, true, &token))
+        return false;
+      if (token.n_name > 0)
+      {
+        sp->current->rating = strtod (token.name, (char **) NULL);
+        sp->fields |= EPISODE_HAS_RATING;
+      }
+      return true;
+  }
+  return true;
 }
 
+/* Runs the scan over what has arrived of the page. LAST says there is no
+   more to come. */
 static void
-set_season_rating (struct season *season)
+season_parser_scan (struct season_parser *sp, bool last)
 {
-  int e;
+  size_t n;
+  const char *b;
+
+  b = sp->pending.buffer;
+  for (;;)
+  {
+    if (sp->mark < 0)
+      sp->mark = scanner_next (&scanners[PAGE_SEASON], &sp->cursor,
+                               b, sp->pending.n);
+    if (sp->mark < 0 ||
+        !season_parser_mark (sp, sp->mark, b + sp->cursor.offset,
+                             b + sp->pending.n, last))
+      break;
+    sp->mark = -1;
+  }
+
+  /* drop what has been dealt with, but keep the text of a link that may
+     still be going on and that of the last one */
+  if (sp->cursor.offset <= EPISODE_LOOKBEHIND)
+    return;
+  n = sp->cursor.offset - EPISODE_LOOKBEHIND;
+  if (sp->n_title && sp->title_at < n)
+    n = sp->title_at;
+  if (n == 0)
+    return;
+  sp->pending.n -= n;
+  memmove (sp->pending.buffer, sp->pending.buffer + n, sp->pending.n + 1);
+  sp->cursor.offset -= n;
+  if (sp->n_title)
+    sp->title_at -= n;
+}
+
+static void
+season_parser_finish (struct season_parser *sp)
+{
+  int i;
+
+  if (sp->pending.buffer)
+    season_parser_scan (sp, true);
+  season_parser_end_episode (sp);
+
+  /* episodes are numbered from 1 on, anything past a gap is ignored */
+  for (i = 0; i < sp->size && sp->seen[i]; ++i)
+    sp->season->total_episodes++;
+
+  /* the spare buffers belong to the main thread, so the page is let go
+     of here rather than kept until every season is in */
+  tvi_buffer_free (&sp->pending);
+  tvi_buffer_free (&sp->incoming);
+}
+
+/* Job of the worker pool: scans whatever has been handed over to the
+   season parser at DATA, and wraps its page up once all of it is in. */
+static void
+season_parser_run (void *data)
+{
+  bool ending;
+  struct tvi_buffer b;
+  struct season_parser *sp;
+
+  sp = (struct season_parser *) data;
+  for (;;)
+  {
+    pthread_mutex_lock (&sp->lock);
+    if (sp->incoming.n == 0)
+    {
+      ending = sp->ending;
+      sp->queued = false;
+      pthread_mutex_unlock (&sp->lock);
+      if (ending)
+        season_parser_finish (sp);
+      return;
+    }
+    if (sp->pending.n == 0)
+    {
+      /* nothing to add to, so take the bytes as they are */
+      b = sp->pending;
+      sp->pending = sp->incoming;
+      sp->incoming = b;
+    }
+    else
+      tvi_buffer_append (&sp->pending, sp->incoming.buffer, sp->incoming.n);
+    tvi_buffer_clear (&sp->incoming);
+    pthread_mutex_unlock (&sp->lock);
+    season_parser_scan (sp, false);
+  }
+}
+
+/* Puts SP on the worker pool, unless it is on it already. It is called
+   with the lock of SP held and lets go of it. */
+static void
+season_parser_queue (struct season_parser *sp)
+{
+  bool queue;
+
+  queue = !sp->queued;
+  sp->queued = true;
+  pthread_mutex_unlock (&sp->lock);
+  if (queue)
+    pool_add (&workers, &season_parser_run, sp);
+}
+
+/* Hands the N bytes at BUF of the page over to SP. */
+static void
+season_parser_feed (struct season_parser *sp, const char *buf, size_t n)
+{
+  pthread_mutex_lock (&sp->lock);
+  tvi_buffer_append (&sp->incoming, buf, n);
+  season_parser_queue (sp);
+}
+
+/* Tells SP the whole page has been handed over. A page that did not go
+   through season_parser_feed() (one from the cache) is given in PAGE,
+   which SP takes over. */
+static void
+season_parser_end (struct season_parser *sp, struct tvi_buffer *page)
+{
+  pthread_mutex_lock (&sp->lock);
+  if (page && sp->incoming.n == 0)
+  {
+    buffer_put (&sp->incoming);
+    sp->incoming = *page;
+    page->buffer = NULL;
+    page->n = 0;
+    page->size = 0;
+  }
+  else if (page)
+    tvi_buffer_append (&sp->incoming, page->buffer, page->n);
+  sp->ending = true;
+  season_parser_queue (sp);
+}
+
+/* Gives the text of SP to the series and lets go of the rest of it. Only
+   to be called once the pool has been waited for. */
+static void
+season_parser_free (struct season_parser *sp)
+{
+  tvi_arena_merge (&series.strings, &sp->strings);
+  buffer_put (&sp->pending);
+  buffer_put (&sp->incoming);
+  pthread_mutex_destroy (&sp->lock);
+}
+
+static void
+init_person (struct person *person)
+{
+  person->name = no_text;
+  person->role = no_text;
+}
+
+static void
+parse_cast_page (void)
+{
+  int i;
+  char *n;
+  char *r;
+  const char *end;
+  const char *p;
+  struct html_token token;
+
+  mark_page (PAGE_CAST);
+  end = page.buffer + page.n;
+  p = page.buffer;
+  /* every person takes up a name marker of their own */
+  series.cast.person = tvi_arena_newa (&series.strings, struct person,
+                                       marks.n[MARK_CAST_NAME]);
+  for (i = 0, n = page_mark (MARK_CAST_NAME, p);
+       (size_t) i < marks.n[MARK_CAST_NAME] && n && *n;
+       ++i, n = page_mark (MARK_CAST_NAME, p))
+  {
+    series.cast.total_people++;
+    init_person (&PERSON (i));
+    page_text (n, end, true, false, &token);
+    PERSON (i).name = series_text (token.name, token.name + token.n_name);
+    p = token.name + token.n_name;
+    r = page_mark (MARK_CAST_ROLE, p);
+    if (r && *r)
+    {
+      page_text (r, end, true, false, &token);
+      PERSON (i).role = series_text (token.name, token.name + token.n_name);
+      p = token.name + token.n_name;
+    }
+  }
+}
+
+static void
+set_series_start_end_airs (void)
+{
+  series.air_start = FIRST_EPISODE_OF (SEASON (0)).air;
+  series.air_end = LAST_EPISODE_OF (LAST_SEASON).air;
+}
+
+static void
+set_series_total_episodes (void)
+{
+  int s;
+
+  for (s = 0; s < series.total_seasons; ++s)
+    series.total_episodes += SEASON (s).total_episodes;
+}
+
+static void
+set_series_rating (void)
+{
+  int s;
   int total;
   double x;
 
-  /* get average of all episode ratings this season */
+  /* get average of all season ratings for a rating of the entire series */
   total = 0;
   x = 0.0f;
 
-  for (e = 0; e < season->total_episodes; ++e)
+  for (s = 0; s < series.total_seasons; ++s)
   {
-    if (season->episode[e].has_aired)
+    if (SEASON (s).rating >= 0.0f)
     {
       total++;
-      x += season->episode[e].rating;
+      x += SEASON (s).rating;
+    }
+  }
+  series.rating = x / total;
+}
+
+/* Appends S (with its NUL) to the string table T and returns its offset. */
+static uint32_t
+string_table_add (struct tvi_buffer *t, const char *s)
+{
+  uint32_t offset;
+
+  offset = (uint32_t) t->n;
+  tvi_buffer_append (t, s, strlen (s) + 1);
+  return offset;
+}
+
+static char *
+snapshot_path (void)
+{
+  char name[TVI_BUFMAX + sizeof (SNAPSHOT_SUFFIX)];
+
+  snprintf (name, sizeof (name), "%s" SNAPSHOT_SUFFIX, series.title.url);
+  return cache_path (SNAPSHOT_DIR, name);
+}
+
+/* Returns how long a snapshot with the SERIES_HAS_* bits LOADED is good
+   for. */
+static time_t
+snapshot_ttl (const struct tvi_options *x, unsigned int loaded)
+{
+  time_t ttl;
+
+  ttl = x->ttl[PAGE_EPISODES];
+  if (x->ttl[PAGE_SEASON] < ttl)
+    ttl = x->ttl[PAGE_SEASON];
+  if ((loaded & SERIES_HAS_CAST) && x->ttl[PAGE_CAST] < ttl)
+    ttl = x->ttl[PAGE_CAST];
+  return ttl;
+}
+
+/* Writes the parts of the series model that have been retrieved to a
+   snapshot file in the cache. The file is a fixed size header followed by
+   arrays of fixed size season, episode and person records and a string
+   table that the records refer to by offset, so any record can be found
+   in a mapped file without parsing the ones before it. */
+static void
+save_series_snapshot (const struct tvi_options *x)
+{
+  bool ok;
+  int e;
+  int i;
+  int s;
+  char *path;
+  char tmp[TVI_BUFMAX * 2];
+  FILE *fp;
+  struct tvi_buffer t = TVI_BUFFER_INIT;
+  struct snapshot_header h;
+  struct snapshot_season *sr;
+  struct snapshot_episode *er;
+  struct snapshot_person *pr;
+
+  if (!x->use_cache || !*series.title.url)
+    return;
+
+  path = snapshot_path ();
+  if (!path)
+    return;
+
+  memset (&h, 0, sizeof (h));
+  memcpy (h.magic, SNAPSHOT_MAGIC, sizeof (h.magic));
+  h.version = SNAPSHOT_VERSION;
+  h.byte_order = SNAPSHOT_BYTE_ORDER;
+  h.created = (int64_t) time (NULL);
+  h.rating = series.rating;
+  h.flags = series.loaded;
+  h.ended = series.schedule.ended;
+  h.total_seasons = series.total_seasons;
+  h.total_people = series.cast.total_people;
+  h.title = string_table_add (&t, series.title.proper.s);
+  h.description = string_table_add (&t, series.description ?
+                                    series.description : EMPTY_DESCRIPTION);
+  h.day = string_table_add (&t, series.schedule.day.s);
+  h.time = string_table_add (&t, series.schedule.time.s);
+  h.network = string_table_add (&t, series.schedule.network.s);
+  h.air_start = string_table_add (&t, series.air_start.s);
+  h.air_end = string_table_add (&t, series.air_end.s);
+
+  for (s = 0, e = 0; s < series.total_seasons; ++s)
+    if (SEASON (s).loaded)
+      e += SEASON (s).total_episodes;
+
+  sr = tvi_newa (struct snapshot_season, series.total_seasons + 1);
+  er = tvi_newa (struct snapshot_episode, e + 1);
+  pr = tvi_newa (struct snapshot_person, series.cast.total_people + 1);
+
+  /* season records are always written since the number of seasons is known
+     from the episodes page, but they are only filled in (and the episode
+     records written) for the season pages that have been retrieved */
+  h.total_episodes = 0;
+  for (s = 0; s < series.total_seasons; ++s)
+  {
+    sr[s].rating = SEASON (s).rating;
+    sr[s].loaded = SEASON (s).loaded;
+    sr[s].total_episodes = 0;
+    sr[s].first_episode = h.total_episodes;
+    sr[s].reserved = 0;
+    if (SEASON (s).loaded)
+    {
+      sr[s].total_episodes = SEASON (s).total_episodes;
+      for (e = 0; e < SEASON (s).total_episodes; ++e, ++h.total_episodes)
+      {
+        struct episode *episode = &EPISODE (SEASON (s), e);
+        er[h.total_episodes].rating = episode->rating;
+        er[h.total_episodes].has_aired = episode->has_aired;
+        er[h.total_episodes].air = string_table_add (&t, episode->air.s);
+        er[h.total_episodes].title = string_table_add (&t, episode->title.s);
+        er[h.total_episodes].description =
+          string_table_add (&t, episode->description ?
+                                episode->description : EMPTY_DESCRIPTION);
+      }
+    }
+  }
+
+  for (i = 0; i < series.cast.total_people; ++i)
+  {
+    pr[i].name = string_table_add (&t, PERSON (i).name.s);
+    pr[i].role = string_table_add (&t, PERSON (i).role.s);
+  }
+  h.strings_size = t.n;
+
+  snprintf (tmp, sizeof (tmp), "%s.%li", path, (long) getpid ());
+  fp = fopen (tmp, "wb");
+  if (fp)
+  {
+    ok = fwrite (&h, sizeof (h), 1, fp) == 1 &&
+         fwrite (sr, sizeof (*sr), h.total_seasons, fp) == h.total_seasons &&
+         fwrite (er, sizeof (*er), h.total_episodes, fp) ==
+           h.total_episodes &&
+         fwrite (pr, sizeof (*pr), h.total_people, fp) == h.total_people &&
+         fwrite (t.buffer, 1, t.n, fp) == t.n;
+    ok = (fclose (fp) == 0) && ok;
+    if (!ok || rename (tmp, path) == -1)
+    {
+      tvi_debug ("failed to write series snapshot \"%s\"", path);
+      unlink (tmp);
+    }
+    else
+      tvi_debug ("saved series snapshot \"%s\"", path);
+  }
+
+  tvi_free (sr);
+  tvi_free (er);
+  tvi_free (pr);
+  tvi_buffer_free (&t);
+  tvi_free (path);
+}
+
+/* Returns a view of the string at OFFSET in the string table STRINGS. */
+static struct tvi_str
+snapshot_string (const char *strings, uint32_t offset)
+{
+  struct tvi_str v;
+
+  v.s = strings + offset;
+  v.n = strlen (v.s);
+  return v;
+}
+
+/* Checks that every offset in the mapped snapshot at BASE (N bytes long)
+   points inside of it. */
+static bool
+snapshot_is_valid (const char *base, size_t n)
+{
+  uint32_t i;
+  size_t size;
+  const struct snapshot_header *h;
+  const struct snapshot_season *sr;
+  const struct snapshot_episode *er;
+  const struct snapshot_person *pr;
+
+#define __offset_ok(o) ((o) < h->strings_size)
+  if (n < sizeof (*h))
+    return false;
+  h = (const struct snapshot_header *) base;
+  if (memcmp (h->magic, SNAPSHOT_MAGIC, sizeof (h->magic)) != 0 ||
+      h->version != SNAPSHOT_VERSION ||
+      h->byte_order != SNAPSHOT_BYTE_ORDER)
+    return false;
+
+  size = sizeof (*h) +
+         (size_t) h->total_seasons * sizeof (*sr) +
+         (size_t) h->total_episodes * sizeof (*er) +
+         (size_t) h->total_people * sizeof (*pr) +
+         h->strings_size;
+  if (size != n || h->strings_size == 0 || base[n - 1] != '\0')
+    return false;
+
+  if (!__offset_ok (h->title) || !__offset_ok (h->description) ||
+      !__offset_ok (h->day) || !__offset_ok (h->time) ||
+      !__offset_ok (h->network) || !__offset_ok (h->air_start) ||
+      !__offset_ok (h->air_end))
+    return false;
+
+  sr = (const struct snapshot_season *) (h + 1);
+  er = (const struct snapshot_episode *) (sr + h->total_seasons);
+  pr = (const struct snapshot_person *) (er + h->total_episodes);
+
+  for (i = 0; i < h->total_seasons; ++i)
+    if (sr[i].total_episodes > h->total_episodes ||
+        (!sr[i].loaded && sr[i].total_episodes > 0) ||
+        sr[i].first_episode > h->total_episodes - sr[i].total_episodes)
+      return false;
+  for (i = 0; i < h->total_episodes; ++i)
+    if (!__offset_ok (er[i].air) || !__offset_ok (er[i].title) ||
+        !__offset_ok (er[i].description))
+      return false;
+  for (i = 0; i < h->total_people; ++i)
+    if (!__offset_ok (pr[i].name) || !__offset_ok (pr[i].role))
+      return false;
+#undef __offset_ok
+  return true;
+}
+
+/* Maps the snapshot of the series into memory and returns it, if there
+   is one that is valid and still fresh. PATH is set to where the file is
+   and SIZE to its size. */
+static const char *
+map_series_snapshot (const struct tvi_options *x, char **path, size_t *size)
+{
+  int fd;
+  const char *base;
+  struct stat st;
+  const struct snapshot_header *h;
+
+  if (!x->use_cache || x->refresh || !*series.title.url)
+    return NULL;
+
+  *path = snapshot_path ();
+  if (!*path)
+    return NULL;
+
+  fd = open (*path, O_RDONLY);
+  if (fd == -1)
+  {
+    tvi_free (*path);
+    return NULL;
+  }
+
+  if (fstat (fd, &st) == -1 || st.st_size == 0)
+  {
+    close (fd);
+    tvi_free (*path);
+    return NULL;
+  }
+
+  base = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (base == MAP_FAILED)
+  {
+    tvi_free (*path);
+    return NULL;
+  }
+
+  if (!snapshot_is_valid (base, st.st_size))
+  {
+    tvi_debug ("series snapshot \"%s\" is invalid", *path);
+    munmap ((void *) base, st.st_size);
+    tvi_free (*path);
+    return NULL;
+  }
+
+  h = (const struct snapshot_header *) base;
+  if (time (NULL) - (time_t) h->created >= snapshot_ttl (x, h->flags))
+  {
+    tvi_debug ("series snapshot \"%s\" is stale", *path);
+    munmap ((void *) base, st.st_size);
+    tvi_free (*path);
+    return NULL;
+  }
+
+  *size = st.st_size;
+  return base;
+}
+
+/* Returns true if load_series_snapshot() would load the series. */
+static bool
+have_series_snapshot (const struct tvi_options *x)
+{
+  char *path;
+  size_t size;
+  const char *base;
+
+  base = map_series_snapshot (x, &path, &size);
+  if (!base)
+    return false;
+  munmap ((void *) base, size);
+  tvi_free (path);
+  return true;
+}
+
+/* Fills the series model from its snapshot in the cache, if there is one
+   that is recent enough. */
+static bool
+load_series_snapshot (const struct tvi_options *x)
+{
+  bool aired_since;
+  uint32_t e;
+  uint32_t i;
+  uint32_t s;
+  char *path;
+  size_t size;
+  const char *base;
+  const char *strings;
+  const struct snapshot_header *h;
+  const struct snapshot_season *sr;
+  const struct snapshot_episode *er;
+  const struct snapshot_person *pr;
+
+  base = map_series_snapshot (x, &path, &size);
+  if (!base)
+    return false;
+
+  h = (const struct snapshot_header *) base;
+  series.loaded = h->flags & (SERIES_HAS_SEASONS | SERIES_HAS_CAST);
+
+  sr = (const struct snapshot_season *) (h + 1);
+  er = (const struct snapshot_episode *) (sr + h->total_seasons);
+  pr = (const struct snapshot_person *) (er + h->total_episodes);
+  strings = (const char *) (pr + h->total_people);
+
+  /* the string table is taken over as a whole, every string of the model
+     points into it */
+  strings = tvi_arena_strdup (&series.strings, strings, h->strings_size - 1);
+
+  series.title.proper = snapshot_string (strings, h->title);
+  series.description = strings + h->description;
+  series.schedule.ended = h->ended;
+  series.schedule.day = snapshot_string (strings, h->day);
+  series.schedule.time = snapshot_string (strings, h->time);
+  series.schedule.network = snapshot_string (strings, h->network);
+  series.air_start = snapshot_string (strings, h->air_start);
+  series.air_end = snapshot_string (strings, h->air_end);
+  series.rating = h->rating;
+
+  series.total_seasons = h->total_seasons;
+  series.season = tvi_arena_newa (&series.strings, struct season,
+                                  h->total_seasons);
+  for (s = 0; s < h->total_seasons; ++s)
+  {
+    init_season (&SEASON (s));
+    if (!sr[s].loaded)
+      continue;
+    SEASON (s).loaded = true;
+    SEASON (s).rating = sr[s].rating;
+    SEASON (s).total_episodes = sr[s].total_episodes;
+    SEASON (s).episode = tvi_arena_newa (&series.strings, struct episode,
+                                         sr[s].total_episodes);
+    aired_since = false;
+    for (e = 0; e < sr[s].total_episodes; ++e)
+    {
+      const struct snapshot_episode *r = &er[sr[s].first_episode + e];
+      struct episode *episode = &EPISODE (SEASON (s), e);
+      init_episode (episode);
+      episode->rating = r->rating;
+      episode->has_aired = r->has_aired;
+      episode->air = snapshot_string (strings, r->air);
+      episode->title = snapshot_string (strings, r->title);
+      episode->description = strings + r->description;
+      episode->air_time = episode_air_time (episode);
+      if (!episode->has_aired && episode->air_time < air_clock_now)
+        aired_since = true;
+    }
+    /* an episode that has aired since the snapshot was made was saved
+       without its rating, so its season page is retrieved again */
+    if (aired_since)
+    {
+      tvi_debug ("season %u has aired since the snapshot", s + 1);
+      init_season (&SEASON (s));
+      SEASON (s).loaded = false;
+      series.loaded &= ~SERIES_HAS_SEASONS;
     }
   }
-  season->rating = x / total;
+  if (series.loaded & SERIES_HAS_SEASONS)
+    series.total_episodes = h->total_episodes;
+  build_episode_columns ();
+
+  series.cast.total_people = h->total_people;
+  series.cast.person = tvi_arena_newa (&series.strings, struct person,
+                                       h->total_people);
+  for (i = 0; i < h->total_people; ++i)
+  {
+    init_person (&PERSON (i));
+    PERSON (i).name = snapshot_string (strings, pr[i].name);
+    PERSON (i).role = snapshot_string (strings, pr[i].role);
+  }
+
+  tvi_debug ("loaded series snapshot \"%s\"", path);
+  munmap ((void *) base, size);
+  tvi_free (path);
+  return true;
+}
+
+static void
+season_fetch_feed (struct fetch *f, const char *buf, size_t n)
+{
+  season_parser_feed ((struct season_parser *) f->data, buf, n);
+}
+
+static void
+season_fetch_done (struct fetch *f)
+{
+  struct season_parser *sp;
+
+  sp = (struct season_parser *) f->data;
+  /* pages from the cache did not go through the parser while downloading */
+  season_parser_end (sp, f->fed ? NULL : &f->page);
+  SEASON (f->season).loaded = true;
+  buffer_put (&f->page);
 }
 
+/* Starts the worker pool with a thread for each processor (up to
+   PARSE_THREADS_MAX of them). With a single processor there is no point,
+   so the parsing is then done by the main thread. */
 static void
-parse_season_page (struct season *season)
+start_workers (void)
+{
+  long n;
+
+  if (have_workers)
+    return;
+  n = sysconf (_SC_NPROCESSORS_ONLN);
+  if (n > PARSE_THREADS_MAX)
+    n = PARSE_THREADS_MAX;
+  pool_init (&workers, (n > 1) ? (int) n : 0);
+  have_workers = true;
+  tvi_debug ("%i worker threads", workers.n_threads);
+}
+
+/* Retrieves the seasons marked in WANT that are not loaded yet. Returns
+   how many were retrieved. */
+static int
+retrieve_seasons (const bool *want, const struct tvi_options *x)
 {
   int i;
-  char *p;
-  struct episode *episode;
+  int n;
+  struct fetch *f;
+  struct season_parser *sp;
+
+  f = tvi_newa (struct fetch, series.total_seasons);
+  sp = tvi_newa (struct season_parser, series.total_seasons);
+  for (i = 0, n = 0; i < series.total_seasons; ++i)
+  {
+    if (!want[i] || SEASON (i).loaded)
+      continue;
+    init_fetch (&f[n], PAGE_SEASON);
+    f[n].season = i;
+    f[n].feed = &season_fetch_feed;
+    f[n].data = &sp[n];
+    format_url (f[n].url, SEASON_URL, series.title.url, i + 1);
+    season_parser_init (&sp[n], &SEASON (i),
+                        series.listing ? series.listing[i].episodes : -1);
+    n++;
+  }
 
-  init_season (season);
-  for (i = 0; i < TVI_BUFMAX; ++i)
+  /* the seasons are only complete (and the text of every one of them in
+     the series) once all of the parse jobs are done */
+  if (n > 0)
   {
-    episode_pattern (e, i + 1);
-    p = strstr (page.buffer, html_pattern_e);
-    if (!p)
-      break;
-    season->total_episodes++;
-    episode = &season->episode[i];
-    init_episode (episode);
-    parse_episode_title (episode, &p);
-    parse_episode_air (episode, &p);
-    set_episode_has_aired (episode);
-    parse_episode_rating (episode, &p);
-    parse_episode_description (episode, &p);
+    start_workers ();
+    fetch_all (f, n, &season_fetch_done, x);
+    pool_wait (&workers);
+  }
+  for (i = 0; i < n; ++i)
+    season_parser_free (&sp[i]);
+  if (n > 0)
+  {
+    build_episode_columns ();
+    for (i = 0; i < n; ++i)
+      set_season_rating (f[i].season);
   }
-  set_season_rating (season);
+  tvi_free (sp);
+  tvi_free (f);
+  return n;
 }
 
-static void
-init_person (struct person *person)
+static bool
+season_has_aired (const struct season *season)
 {
-  person->n_name = 0;
-  person->n_role = 0;
-  person->name[0] = '\0';
-  person->role[0] = '\0';
+  int e;
+
+  for (e = 0; e < season->total_episodes; ++e)
+    if (season->episode[e].has_aired)
+      return true;
+  return false;
 }
 
-static void
-parse_cast_page (void)
+/* Retrieves only the seasons needed to answer the query in X: the ones
+   given with --season, or every season for queries about the whole
+   series. --last and --next walk backwards from the last season until one
+   that has aired episodes turns up, since everything they need to look at
+   comes after the most recently aired episode. Returns how many season
+   pages were retrieved. */
+static int
+retrieve_needed_seasons (const struct tvi_options *x)
 {
   int i;
-  char *n;
-  char *p;
-  char *r;
+  int n;
+  int s;
+  bool *want;
 
-  r = NULL;
-  p = page.buffer;
-  for (i = 0, n = strstr (p, CAST_NAME_PATTERN);
-       i < TVI_BUFMAX && n && *n;
-       ++i, n = strstr (p, CAST_NAME_PATTERN))
+  if (series.total_seasons == 0)
   {
-    series.cast.total_people++;
-    init_person (&PERSON (i));
-    for (n += n_cast_name_pattern; *n != '>'; ++n)
-      ;
-    if (*n == '>')
-      n++;
-    for (p = PERSON (i).name; *n != '<'; ++p, ++n)
+    series.loaded |= SERIES_HAS_SEASONS;
+    return 0;
+  }
+
+  want = tvi_newa (bool, series.total_seasons);
+  memset (want, 0, series.total_seasons * sizeof (bool));
+  n = 0;
+
+  if (x->last || x->next)
+  {
+    for (s = series.total_seasons - 1; s >= 0; --s)
     {
-      while (is_entity_ref (n))
-        *p++ = entity_ref_char (&n);
-      *p = *n;
+      want[s] = true;
+      n += retrieve_seasons (want, x);
+      if (season_has_aired (&SEASON (s)))
+        break;
     }
-    *p = '\0';
-    PERSON (i).n_name = strlen (PERSON (i).name);
-    r = strstr (n, CAST_ROLE_PATTERN);
-    if (r && *r)
+  }
+  else
+  {
+    if (x->s.n > 0)
     {
-      r += n_cast_role_pattern;
-      for (p = PERSON (i).role; *r != '<'; ++r, ++p)
-      {
-        while (is_entity_ref (r))
-          *p++ = entity_ref_char (&r);
-        *p = *r;
-      }
-      *p = '\0';
-      PERSON (i).n_role = strlen (PERSON (i).role);
-      p = r;
+      for (i = 0; i < x->s.n; ++i)
+        if (x->s.v[i] > 0 && x->s.v[i] <= series.total_seasons)
+          want[x->s.v[i] - 1] = true;
     }
+    else
+      memset (want, 1, series.total_seasons * sizeof (bool));
+    n = retrieve_seasons (want, x);
   }
-}
-
-static void
-set_series_start_end_airs (void)
-{
-  memcpy (series.air_start,
-          EPISODE (SEASON (0), 0).air,
-          strlen (EPISODE (SEASON (0), 0).air) + 1);
-
-  memcpy (series.air_end,
-          LAST_EPISODE_OF (LAST_SEASON).air,
-          strlen (LAST_EPISODE_OF (LAST_SEASON).air) + 1);
-}
-
-static void
-set_series_total_episodes (void)
-{
-  int s;
+  tvi_free (want);
 
+  /* the totals and ratings of the series need every season */
+  if (series.loaded & SERIES_HAS_SEASONS)
+    return n;
   for (s = 0; s < series.total_seasons; ++s)
-    series.total_episodes += SEASON (s).total_episodes;
+    if (!SEASON (s).loaded)
+      return n;
+  set_series_start_end_airs ();
+  set_series_total_episodes ();
+  set_series_rating ();
+  series.loaded |= SERIES_HAS_SEASONS;
+  return n;
 }
 
-static void
-set_series_rating (void)
+/* Searches for the series. The episodes page of the URL title guessed
+   from the given title is requested at the same time, and if the search
+   agrees with the guess that page is left in the global page buffer and
+   true is returned, which saves waiting for another round trip. The
+   guess is not requested if there is a snapshot of it to load instead. */
+static bool
+search_series (const struct tvi_options *x)
 {
-  int s;
-  int total;
-  double x;
-
-  /* get average of all season ratings for a rating of the entire series */
-  total = 0;
-  x = 0.0f;
+  bool hit;
+  bool want_guess;
+  char guess[TVI_BUFMAX];
+  char url[TVI_BUFMAX];
+  struct fetch f[2];
+  struct page_matcher m[2];
 
-  for (s = 0; s < series.total_seasons; ++s)
+  search_url (search);
+  set_url_title_best_guess ();
+  want_guess = !have_series_snapshot (x);
+  memcpy (guess, series.title.url, TVI_BUFMAX);
+  *series.title.url = '\0';
+  format_url (url, EPISODES_URL, guess);
+
+  init_page_fetch (&f[0], &m[0], url_search, PAGE_SEARCH);
+  init_page_fetch (&f[1], &m[1], url, PAGE_EPISODES);
+  f[1].optional = true;
+  fetch_all (f, (want_guess) ? 2 : 1, &page_fetch_keep, x);
+
+  buffer_put (&page);
+  page = f[0].page;
+  /* guesses are not remembered, the search may do better next time */
+  if (parse_search_page ())
+    update_title_index (x);
+
+  if (!want_guess)
   {
-    if (SEASON (s).rating >= 0.0f)
-    {
-      total++;
-      x += SEASON (s).rating;
-    }
+    tvi_debug ("a snapshot of guessed URL title \"%s\" is kept", guess);
+    buffer_put (&page);
+    return false;
   }
-  series.rating = x / total;
+
+  hit = !f[1].failed && strcmp (series.title.url, guess) == 0;
+  tvi_debug ("guessed URL title \"%s\" was %s", guess,
+             hit ? "right" : "wrong");
+  buffer_put (&page);
+  if (hit)
+    page = f[1].page;
+  else
+    buffer_put (&f[1].page);
+  return hit;
 }
 
 static void
 retrieve_series (const struct tvi_options *x)
 {
-  search_url (search);
-
-  if (!try_connect (url_search, x))
-    tvi_die (E_INTERNET, "failed to connect to \"%s\"", url_search);
-
-  parse_search_page ();
-
-  episodes_url (episodes);
-  if (!try_connect (url_episodes, x))
-    tvi_die (E_INTERNET, "failed to connect to \"%s\"", url_episodes);
+  bool changed;
+  bool have_episodes;
 
-  parse_episodes_page ();
+  have_episodes = false;
+  if (!lookup_title_index (x))
+    have_episodes = search_series (x);
 
-  if (x->cast)
+  if (!load_series_snapshot (x))
   {
-    cast_url (cast);
-    if (!try_connect (url_cast, x))
-      tvi_die (E_INTERNET, "failed to connect to \"%s\"", url_cast);
-    parse_cast_page ();
-    return;
+    if (!have_episodes)
+    {
+      episodes_url (episodes);
+      fetch_page (url_episodes, PAGE_EPISODES, x);
+    }
+    parse_episodes_page ();
   }
+  changed = false;
 
-  int i;
-
-  for (i = 0; i < series.total_seasons; ++i)
+  if (x->cast)
   {
-    season_url (season, i + 1);
-    if (!try_connect (url_season, x))
-      tvi_die (E_INTERNET, "failed to connect to \"%s\"", url_season);
-    parse_season_page (&SEASON (i));
+    if (!(series.loaded & SERIES_HAS_CAST))
+    {
+      cast_url (cast);
+      fetch_page (url_cast, PAGE_CAST, x);
+      parse_cast_page ();
+      series.loaded |= SERIES_HAS_CAST;
+      changed = true;
+    }
   }
+  else if (retrieve_needed_seasons (x) > 0)
+    changed = true;
 
-  set_series_start_end_airs ();
-  set_series_total_episodes ();
-  set_series_rating ();
+  if (changed)
+    save_series_snapshot (x);
 }
 
 static void
@@ -1279,7 +3711,8 @@ display_description (const char *desc)
   do \
   { \
     fputc (__c, stdout); \
-    n++; \
+    if ((__c & 0xc0) != 0x80) \
+      n++; \
   } while (0)
 
 #define __put_w(__w) \
@@ -1307,7 +3740,7 @@ display_description (const char *desc)
     for (w = word; *p && !isspace (*p); ++p, ++w)
       *w = *p;
     *w = '\0';
-    n_word = strlen (word);
+    n_word = tvi_utf8_width (word);
     if (n + n_word >= stop)
     {
       fputc ('\n', stdout);
@@ -1328,7 +3761,7 @@ display_episode (int s, int e, const struct tvi_options *x)
 {
   struct episode *episode = &EPISODE (SEASON (s), e);
 
-  printf ("Season %i Episode %i: %s\n", s + 1, e + 1, episode->title);
+  printf ("Season %i Episode %i: %s\n", s + 1, e + 1, episode->title.s);
 
   if (x->attrs & ATTR_RATING)
   {
@@ -1342,7 +3775,7 @@ display_episode (int s, int e, const struct tvi_options *x)
 
   if (x->attrs & ATTR_AIR)
   {
-    printf ("  Air Date:    %s", episode->air);
+    printf ("  Air Date:    %s", episode->air.s);
     if (!episode->has_aired)
       fputs (" (not yet aired)", stdout);
     fputc ('\n', stdout);
@@ -1386,8 +3819,8 @@ person_compare (const struct person *person, const struct query *query)
   int i;
 
   for (i = 0; i < query->total_tokens; ++i)
-    if (tvi_strcasestr (person->name, query->token[i].str) ||
-        tvi_strcasestr (person->role, query->token[i].str))
+    if (tvi_strcasestr (person->name.s, query->token[i].str) ||
+        tvi_strcasestr (person->role.s, query->token[i].str))
       return true;
   return false;
 }
@@ -1424,8 +3857,9 @@ display_cast_and_crew (const char *pattern)
   {
     if (pattern && !person_compare (&PERSON (i), &query))
       continue;
-    if (PERSON (i).n_name > longest)
-      longest = PERSON (i).n_name;
+    n = tvi_utf8_width (PERSON (i).name.s);
+    if (n > longest)
+      longest = n;
   }
 
   printf ("%s cast and crew (", TITLE);
@@ -1453,12 +3887,54 @@ display_cast_and_crew (const char *pattern)
   {
     if (pattern && !person_compare (&PERSON (i), &query))
       continue;
-    __print_line (PERSON (i).name, PERSON (i).n_name, PERSON (i).role);
+    __print_line (PERSON (i).name.s, tvi_utf8_width (PERSON (i).name.s),
+                  PERSON (i).role.s);
   }
 
 #undef __print_line
 }
 
+/* Prints the episodes ranked by --top or --bottom, under a heading for
+   the series or for each season they were ranked in. */
+static void
+display_ranked_episodes (const struct tvi_options *x)
+{
+  int i;
+  int j;
+  int k;
+  int n;
+
+  k = (x->top) ? x->top : x->bottom;
+  for (i = 0; i < x->s.n; i = j)
+  {
+    for (j = i + 1; j < x->s.n; ++j)
+      if (x->rank_seasons && x->s.v[j] != x->s.v[i])
+        break;
+    if (i > 0)
+      fputc ('\n', stdout);
+    if (x->e.v[i] == -1)
+    {
+      if (x->rank_seasons)
+        printf ("Season %i of \"%s\" has not yet aired any episodes.\n",
+                x->s.v[i], TITLE);
+      else
+        printf ("\"%s\" has not yet aired any episodes.\n", TITLE);
+      continue;
+    }
+    n = (j - i < k) ? j - i : k;
+    printf ("%s %i rated episode%s of ",
+            (x->top) ? "Top" : "Bottom", n, (n == 1) ? "" : "s");
+    if (x->rank_seasons)
+      printf ("season %i of ", x->s.v[i]);
+    printf ("\"%s\"", TITLE);
+    if (j - i > k)
+      printf (" (%i with ties)", j - i);
+    fputs (":\n\n", stdout);
+    for (n = i; n < j; ++n)
+      display_episode (x->s.v[n] - 1, x->e.v[n] - 1, x);
+  }
+}
+
 static void
 display_series (const struct tvi_options *x)
 {
@@ -1471,15 +3947,15 @@ display_series (const struct tvi_options *x)
   {
     printf ("%s (%i seasons, %i episodes) %s - %s\n",
             TITLE, series.total_seasons, series.total_episodes,
-            series.air_start, series.air_end);
+            series.air_start.s, series.air_end.s);
     if (series.schedule.ended)
       printf ("Ended in %s on %s\n",
-              series.schedule.time, series.schedule.network);
+              series.schedule.time.s, series.schedule.network.s);
     else
       printf ("Airs %ss at %s on %s\n",
-              series.schedule.day,
-              series.schedule.time,
-              series.schedule.network);
+              series.schedule.day.s,
+              series.schedule.time.s,
+              series.schedule.network.s);
     for (s = 0; s < series.total_seasons; ++s)
       printf ("Season %i rating: %.1f\n", s + 1, SEASON (s).rating);
     printf ("Series overall rating: %.1f\n", series.rating);
@@ -1493,8 +3969,19 @@ display_series (const struct tvi_options *x)
     return;
   }
 
+  if (x->top || x->bottom)
+  {
+    display_ranked_episodes (x);
+    return;
+  }
+
   if (x->highest_rated || x->lowest_rated)
   {
+    if (x->s.v[0] == -1 && x->e.v[0] == -1)
+    {
+      printf ("\"%s\" has not yet aired any episodes.\n", TITLE);
+      return;
+    }
     if (x->e.n > 1)
       printf ("There is a tie between %i %s rated episodes of \"%s\".\n\n",
               x->e.n, (x->highest_rated) ? "highest" : "lowest", TITLE);
@@ -1513,7 +4000,7 @@ display_series (const struct tvi_options *x)
       {
         printf ("\"%s\" has no new episodes.\n", TITLE);
         printf ("The last episode aired on %s.\n",
-                LAST_EPISODE_OF (LAST_SEASON).air);
+                LAST_EPISODE_OF (LAST_SEASON).air.s);
       }
       return;
     }
@@ -1529,8 +4016,8 @@ display_series (const struct tvi_options *x)
       if (x->attrs & ATTR_AIR)
         printf ("%s%s - %s\n",
                 (n_attrs > 1) ? "  Air dates:   " : "",
-                series.air_start,
-                series.air_end);
+                series.air_start.s,
+                series.air_end.s);
       if (x->attrs & ATTR_RATING)
         printf ("%s%.1f\n",
                 (n_attrs > 1) ? "  Rating:      " : "", series.rating);
@@ -1557,8 +4044,8 @@ display_series (const struct tvi_options *x)
           printf ("%s%s%s - %s\n",
                   (x->s.n > 1) ? "  " : "",
                   (n_attrs > 1) ? "Air dates:   " : "",
-                  FIRST_EPISODE_OF (SEASON (x->s.v[i] - 1)).air,
-                  LAST_EPISODE_OF (SEASON (x->s.v[i] - 1)).air);
+                  FIRST_EPISODE_OF (SEASON (x->s.v[i] - 1)).air.s,
+                  LAST_EPISODE_OF (SEASON (x->s.v[i] - 1)).air.s);
         if (x->attrs & ATTR_RATING)
           printf ("%s%s%.1f\n",
                   (x->s.n > 1) ? "  " : "",
@@ -1637,6 +4124,10 @@ verify_options (const struct tvi_options *x)
     if (x->lowest_rated)
       tvi_error (0, "options --cast and --lowest-rated are mutually "
                     "exclusive");
+    if (x->top)
+      tvi_error (0, "options --cast and --top are mutually exclusive");
+    if (x->bottom)
+      tvi_error (0, "options --cast and --bottom are mutually exclusive");
     if (x->next)
       tvi_error (0, "options --cast and --next are mutually exclusive");
     if (x->s.n > 0)
@@ -1650,12 +4141,43 @@ verify_options (const struct tvi_options *x)
         x->last ||
         x->highest_rated ||
         x->lowest_rated ||
+        x->top ||
+        x->bottom ||
         x->next ||
         x->s.n > 0 ||
         x->e.n > 0)
       usage (true);
   }
 
+  if (x->top || x->bottom)
+  {
+    const char *o = (x->top) ? "--top" : "--bottom";
+    if (x->top && x->bottom)
+      tvi_error (0, "options --top and --bottom are mutually exclusive");
+    if (x->highest_rated)
+      tvi_error (0, "options %s and --highest-rated are mutually exclusive",
+                 o);
+    if (x->lowest_rated)
+      tvi_error (0, "options %s and --lowest-rated are mutually exclusive",
+                 o);
+    if (x->info)
+      tvi_error (0, "options %s and --info are mutually exclusive", o);
+    if (x->last)
+      tvi_error (0, "options %s and --last are mutually exclusive", o);
+    if (x->next)
+      tvi_error (0, "options %s and --next are mutually exclusive", o);
+    if (x->e.n > 0)
+      tvi_error (0, "options %s and --episode are mutually exclusive", o);
+    if ((x->top && x->bottom) ||
+        x->highest_rated ||
+        x->lowest_rated ||
+        x->info ||
+        x->last ||
+        x->next ||
+        x->e.n > 0)
+      usage (true);
+  }
+
   if (x->highest_rated)
   {
     if (x->info)
@@ -1746,39 +4268,22 @@ verify_options (const struct tvi_options *x)
 static void
 find_last_to_air_episode (int *season_no, int *episode_no)
 {
-  int e;
-  int s;
-
-  if (series.total_seasons == 0)
-  {
-    *season_no = -1;
-    *episode_no = -1;
-    return;
-  }
-
-  if (LAST_EPISODE_OF (LAST_SEASON).has_aired)
-  {
-    *season_no = series.total_seasons - 1;
-    *episode_no = SEASON (series.total_seasons - 1).total_episodes - 1;
-    return;
-  }
+  int i;
+  const struct episode_columns *c = &series.columns;
 
-  for (s = 0; s < series.total_seasons; ++s)
+  /* only the seasons from the one this finds on have been retrieved */
+  for (i = c->n - 1; i >= 0; --i)
   {
-    e = SEASON (s).total_episodes - 1;
-    if (!EPISODE (SEASON (s), e).has_aired)
+    if (COLUMN_AIRED (c, i))
     {
-      for (e--; e >= 0; --e)
-      {
-        if (EPISODE (SEASON (s), e).has_aired)
-        {
-          *season_no = s;
-          *episode_no = e;
-          return;
-        }
-      }
+      *season_no = c->season[i];
+      *episode_no = i - c->first[c->season[i]];
+      return;
     }
   }
+
+  *season_no = -1;
+  *episode_no = -1;
 }
 
 static void
@@ -1818,115 +4323,173 @@ find_next_to_air_episode (int *season_no, int *episode_no)
   }
 }
 
+/* Returns true if column A is ranked after column B: rated worse (or
+   better, with LOWEST), or rated the same and later in the series. */
+static bool
+rank_after (const double *rating, int a, int b, bool lowest)
+{
+  if (rating[a] != rating[b])
+    return (lowest) ? rating[a] > rating[b] : rating[a] < rating[b];
+  return a > b;
+}
+
 static void
-find_highest_rated_episode (int *sa, int *ea)
+rank_sift_up (int *heap, int i, const double *rating, bool lowest)
 {
-  bool skip;
-  int e;
-  int s;
-  int p;
-  int q;
-  double r;
+  int v;
 
-  r = 0.0f;
-  for (s = 0; s < series.total_seasons; ++s)
+  v = heap[i];
+  while (i > 0 && rank_after (rating, v, heap[(i - 1) / 2], lowest))
   {
-    for (e = 0; e < SEASON (s).total_episodes; ++e)
-    {
-      if (EPISODE (SEASON (s), e).has_aired)
-      {
-        if (EPISODE (SEASON (s), e).rating > r)
-        {
-          ea[0] = e;
-          sa[0] = s;
-          r = EPISODE (SEASON (s), e).rating;
-        }
-      }
-    }
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = v;
+}
+
+static void
+rank_sift_down (int *heap, int n, int i, const double *rating, bool lowest)
+{
+  int j;
+  int v;
+
+  v = heap[i];
+  for (j = 2 * i + 1; j < n; j = 2 * i + 1)
+  {
+    if (j + 1 < n && rank_after (rating, heap[j + 1], heap[j], lowest))
+      j++;
+    if (!rank_after (rating, heap[j], v, lowest))
+      break;
+    heap[i] = heap[j];
+    i = j;
   }
+  heap[i] = v;
+}
 
-  p = 1;
-  for (s = 0; s < series.total_seasons; ++s)
+static void
+rank_append (struct spec *s, struct spec *e, int i)
+{
+  const struct episode_columns *c = &series.columns;
+
+  spec_append (s, c->season[i] + 1);
+  spec_append (e, i - c->first[c->season[i]] + 1);
+}
+
+/* Appends to the specs S and E the K best rated (or worst, with LOWEST)
+   of the aired episodes in columns FROM up to TO, and any others rated
+   the same as the last of them. The columns are gone through once. The
+   ones ranked so far are kept in a heap with the one ranked last on top;
+   another rated the same as that one is put aside in TIES rather than
+   taking its place, and so is the top when a better one pushes it out
+   and the new top is rated the same. Either way the ones put aside are
+   dropped once the top is rated better. They are appended best first,
+   in the order of the series where they tie. Returns how many were. */
+static int
+rank_episodes (int from, int to, int k, bool lowest,
+               struct spec *s, struct spec *e)
+{
+  int i;
+  int n;
+  int t;
+  int *heap;
+  struct spec pushed = {0, 0, NULL};
+  struct spec ties = {0, 0, NULL};
+  const struct episode_columns *c = &series.columns;
+  const double *rating = c->rating;
+
+  if (k > to - from)
+    k = to - from;
+  if (k == 0)
+    return 0;
+  heap = tvi_newa (int, k);
+  n = 0;
+  for (i = from; i < to; ++i)
   {
-    for (e = 0; e < SEASON (s).total_episodes; ++e)
+    if (!COLUMN_AIRED (c, i))
+      continue;
+    if (n < k)
     {
-      if (EPISODE (SEASON (s), e).rating == r)
-      {
-        skip = false;
-        for (q = p - 1; q >= 0; --q)
-        {
-          if (e == ea[q] && s == sa[q])
-          {
-            skip = true;
-            break;
-          }
-        }
-        if (!skip)
-        {
-          ea[p] = e;
-          sa[p++] = s;
-        }
-      }
+      heap[n] = i;
+      rank_sift_up (heap, n++, rating, lowest);
+      continue;
+    }
+    t = heap[0];
+    if (rating[i] == rating[t])
+      spec_append (&ties, i);
+    else if ((lowest) ? rating[i] < rating[t] : rating[i] > rating[t])
+    {
+      heap[0] = i;
+      rank_sift_down (heap, n, 0, rating, lowest);
+      if (rating[heap[0]] == rating[t])
+        spec_append (&pushed, t);
+      else
+        pushed.n = ties.n = 0;
     }
   }
 
-  ea[p] = -1;
-  sa[p] = -1;
+  /* take the heap apart into its order, best first */
+  for (i = n - 1; i > 0; --i)
+  {
+    t = heap[0];
+    heap[0] = heap[i];
+    heap[i] = t;
+    rank_sift_down (heap, i, 0, rating, lowest);
+  }
+  for (i = 0; i < n; ++i)
+    rank_append (s, e, heap[i]);
+  /* each one pushed out came later in the series than the ones tied with
+     it that stayed, and before the one pushed out ahead of it and before
+     any put aside in TIES */
+  for (i = pushed.n - 1; i >= 0; --i)
+    rank_append (s, e, pushed.v[i]);
+  for (i = 0; i < ties.n; ++i)
+    rank_append (s, e, ties.v[i]);
+
+  n += pushed.n + ties.n;
+  tvi_free (pushed.v);
+  tvi_free (ties.v);
+  tvi_free (heap);
+  return n;
 }
 
+/* Replaces the season and episode specs of X with the K best (or worst,
+   with LOWEST) rated episodes of each season given, or of the series if
+   none was. A season is ranked once however many times it is given. One
+   without any aired episodes is given with episode -1, as is the series
+   with season -1. */
 static void
-find_lowest_rated_episode (int *sa, int *ea)
+rank_series (struct tvi_options *x, int k, bool lowest)
 {
-  bool skip;
-  int e;
-  int s;
-  int p;
-  int q;
-  double r;
+  int i;
+  int v;
+  struct spec e = {0, 0, NULL};
+  struct spec s = {0, 0, NULL};
+  const struct episode_columns *c = &series.columns;
 
-  r = DBL_MAX;
-  for (s = 0; s < series.total_seasons; ++s)
+  if (x->s.n == 0)
   {
-    for (e = 0; e < SEASON (s).total_episodes; ++e)
+    if (rank_episodes (0, c->n, k, lowest, &s, &e) == 0)
     {
-      if (EPISODE (SEASON (s), e).has_aired)
-      {
-        if (EPISODE (SEASON (s), e).rating < r)
-        {
-          ea[0] = e;
-          sa[0] = s;
-          r = EPISODE (SEASON (s), e).rating;
-        }
-      }
+      spec_append (&s, -1);
+      spec_append (&e, -1);
     }
   }
-
-  for (s = 0; s < series.total_seasons; ++s)
+  for (i = 0; i < x->s.n; ++i)
   {
-    for (e = 0; e < SEASON (s).total_episodes; ++e)
+    v = x->s.v[i];
+    if (spec_contains (&s, v))
+      continue;
+    if (rank_episodes (c->first[v - 1], c->first[v], k, lowest, &s, &e) == 0)
     {
-      if (EPISODE (SEASON (s), e).rating == r)
-      {
-        skip = false;
-        for (q = p - 1; q >= 0; --q)
-        {
-          if (e == ea[q] && s == sa[q])
-          {
-            skip = true;
-            break;
-          }
-        }
-        if (!skip)
-        {
-          ea[p] = e;
-          sa[p++] = s;
-        }
-      }
+      spec_append (&s, v);
+      spec_append (&e, -1);
     }
   }
-
-  ea[p] = -1;
-  sa[p] = -1;
+  x->rank_seasons = x->s.n > 0;
+  tvi_free (x->s.v);
+  tvi_free (x->e.v);
+  x->s = s;
+  x->e = e;
 }
 
 static void
@@ -1938,16 +4501,7 @@ verify_options_with_series (struct tvi_options *x)
 
   if (x->highest_rated || x->lowest_rated)
   {
-    int ea[TVI_BUFMAX];
-    int sa[TVI_BUFMAX];
-    if (x->highest_rated)
-      find_highest_rated_episode (sa, ea);
-    else
-      find_lowest_rated_episode (sa, ea);
-    for (s = 0; sa[s] != -1; ++s)
-      spec_append (&x->s, sa[s] + 1);
-    for (e = 0; ea[e] != -1; ++e)
-      spec_append (&x->e, ea[e] + 1);
+    rank_series (x, 1, x->lowest_rated);
     x->attrs |= ATTR_AIR | ATTR_DESCRIPTION | ATTR_RATING;
     return;
   }
@@ -2009,6 +4563,13 @@ verify_options_with_series (struct tvi_options *x)
     }
   }
 
+  if (x->top || x->bottom)
+  {
+    rank_series (x, (x->top) ? x->top : x->bottom, x->bottom > 0);
+    x->attrs |= ATTR_RATING;
+    return;
+  }
+
   if (x->s.n > 0 && x->e.n > 0)
   {
     bool had_season_episode_error;
@@ -2050,25 +4611,40 @@ init_tvi_options (struct tvi_options *x)
   x->last = false;
   x->lowest_rated = false;
   x->next = false;
+  x->rank_seasons = false;
   x->show_progress = true;
+  x->stats = false;
   x->attrs = ATTR_0;
+  x->jobs = DEFAULT_JOBS;
+  x->top = 0;
+  x->bottom = 0;
+  x->refresh = false;
+  x->use_cache = true;
+  x->cache_dir = NULL;
+  x->ttl[PAGE_SEARCH] = DEFAULT_TTL_SEARCH;
+  x->ttl[PAGE_EPISODES] = DEFAULT_TTL_EPISODES;
+  x->ttl[PAGE_SEASON] = DEFAULT_TTL_SEASON;
+  x->ttl[PAGE_CAST] = DEFAULT_TTL_CAST;
   x->e.n = 0;
+  x->e.size = 0;
+  x->e.v = NULL;
   x->s.n = 0;
+  x->s.size = 0;
+  x->s.v = NULL;
 }
 
 static void
 cleanup (void)
 {
-  int e;
-  int s;
-
-  tvi_free (page.buffer);
+  if (have_workers)
+    pool_free (&workers);
+  tvi_buffer_free (&page);
+  free_spare_buffers ();
+  free_scanners ();
   tvi_free (series.title.given);
-  tvi_free (series.description);
-
-  for (s = 0; s < series.total_seasons; ++s)
-    for (e = 0; e < SEASON (s).total_episodes; ++e)
-      tvi_free (EPISODE (SEASON (s), e).description);
+  cache_cleanup ();
+  free_episode_columns ();
+  tvi_arena_free (&series.strings);
 }
 
 int
@@ -2083,7 +4659,7 @@ main (int argc, char **argv)
 
   for (;;)
   {
-    c = getopt_long (argc, argv, "ac::de:hHlLnNirs:v", options, NULL);
+    c = getopt_long (argc, argv, "ac::de:hHij:lLnNrs:Sv", options, NULL);
     if (c == -1)
       break;
     switch (c)
@@ -2091,6 +4667,36 @@ main (int argc, char **argv)
       case 'a':
         x.attrs |= ATTR_AIR;
         break;
+      case OPT_CACHE_DIR:
+        x.cache_dir = optarg;
+        break;
+      case OPT_CACHE_TTL:
+        if (!ttl_parse_from_optarg (x.ttl, optarg))
+        {
+          tvi_error (0, "invalid cache-ttl argument -- `%s'", optarg);
+          tvi_die (E_OPTION, TTL_ERROR_MESSAGE);
+        }
+        break;
+      case OPT_NO_CACHE:
+        x.use_cache = false;
+        break;
+      case OPT_REFRESH:
+        x.refresh = true;
+        break;
+      case OPT_TOP:
+        if (!count_parse_from_optarg (&x.top, optarg))
+        {
+          tvi_error (0, "invalid top argument -- `%s'", optarg);
+          tvi_die (E_OPTION, RANK_ERROR_MESSAGE);
+        }
+        break;
+      case OPT_BOTTOM:
+        if (!count_parse_from_optarg (&x.bottom, optarg))
+        {
+          tvi_error (0, "invalid bottom argument -- `%s'", optarg);
+          tvi_die (E_OPTION, RANK_ERROR_MESSAGE);
+        }
+        break;
       case 'c':
         x.cast = true;
         if (optarg)
@@ -2115,6 +4721,13 @@ main (int argc, char **argv)
       case 'i':
         x.info = true;
         break;
+      case 'j':
+        if (!count_parse_from_optarg (&x.jobs, optarg))
+        {
+          tvi_error (0, "invalid jobs argument -- `%s'", optarg);
+          tvi_die (E_OPTION, JOBS_ERROR_MESSAGE);
+        }
+        break;
       case 'l':
         x.last = true;
         break;
@@ -2137,6 +4750,9 @@ main (int argc, char **argv)
           tvi_die (E_OPTION, SPEC_ERROR_MESSAGE);
         }
         break;
+      case 'S':
+        x.stats = true;
+        break;
       case 'v':
         version ();
         break;
@@ -2154,11 +4770,19 @@ main (int argc, char **argv)
 
   verify_options (&x);
   init_series ();
+  init_air_clock ();
   set_series_given_title (argv + optind);
   set_pattern_sizes ();
+  init_scanners ();
+  if (x.use_cache)
+    x.use_cache = cache_init (x.cache_dir);
+  init_connection_context ();
   retrieve_series (&x);
+  cleanup_connection_context ();
   verify_options_with_series (&x);
   display_series (&x);
+  if (x.stats)
+    display_transfer_stats ();
   exit (E_OKAY);
 }
 
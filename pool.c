@@ -0,0 +1,149 @@
+/*
+ * tvi - TV series Information
+ *
+ * Copyright (C) 2014  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "pool.h"
+#include "utils.h"
+
+#define POOL_QUEUE_MIN 16
+
+extern const char *program_name;
+
+static void *
+pool_worker (void *data)
+{
+  struct pool *p;
+  struct pool_job job;
+
+  p = (struct pool *) data;
+  pthread_mutex_lock (&p->lock);
+  for (;;)
+  {
+    while (p->n == 0 && !p->stopping)
+      pthread_cond_wait (&p->queued, &p->lock);
+    if (p->n == 0)
+      break;
+    job = p->jobs[p->head];
+    p->head = (p->head + 1) % p->size;
+    p->n--;
+    p->running++;
+    pthread_mutex_unlock (&p->lock);
+
+    job.run (job.data);
+
+    pthread_mutex_lock (&p->lock);
+    p->running--;
+    if (p->n == 0 && p->running == 0)
+      pthread_cond_broadcast (&p->idle);
+  }
+  pthread_mutex_unlock (&p->lock);
+  return NULL;
+}
+
+void
+pool_init (struct pool *p, int n_threads)
+{
+  int i;
+
+  memset (p, 0, sizeof (*p));
+  pthread_mutex_init (&p->lock, NULL);
+  pthread_cond_init (&p->queued, NULL);
+  pthread_cond_init (&p->idle, NULL);
+  if (n_threads <= 0)
+    return;
+
+  p->threads = tvi_newa (pthread_t, n_threads);
+  for (i = 0; i < n_threads; ++i)
+  {
+    if (pthread_create (&p->threads[i], NULL, pool_worker, p) != 0)
+    {
+      tvi_debug ("could only start %i of %i worker threads", i, n_threads);
+      break;
+    }
+  }
+  p->n_threads = i;
+}
+
+void
+pool_add (struct pool *p, void (*run) (void *), void *data)
+{
+  size_t i;
+  size_t size;
+  struct pool_job *jobs;
+
+  if (p->n_threads == 0)
+  {
+    run (data);
+    return;
+  }
+
+  pthread_mutex_lock (&p->lock);
+  if (p->n == p->size)
+  {
+    /* unroll the ring into a bigger one */
+    size = p->size ? p->size * 2 : POOL_QUEUE_MIN;
+    jobs = tvi_newa (struct pool_job, size);
+    for (i = 0; i < p->n; ++i)
+      jobs[i] = p->jobs[(p->head + i) % p->size];
+    tvi_free (p->jobs);
+    p->jobs = jobs;
+    p->head = 0;
+    p->size = size;
+  }
+  p->jobs[(p->head + p->n) % p->size].run = run;
+  p->jobs[(p->head + p->n) % p->size].data = data;
+  p->n++;
+  pthread_cond_signal (&p->queued);
+  pthread_mutex_unlock (&p->lock);
+}
+
+/* Waits until every job added so far has been run. */
+void
+pool_wait (struct pool *p)
+{
+  pthread_mutex_lock (&p->lock);
+  while (p->n > 0 || p->running > 0)
+    pthread_cond_wait (&p->idle, &p->lock);
+  pthread_mutex_unlock (&p->lock);
+}
+
+/* Lets the jobs still queued run, then stops the threads. */
+void
+pool_free (struct pool *p)
+{
+  int i;
+
+  pthread_mutex_lock (&p->lock);
+  p->stopping = true;
+  pthread_cond_broadcast (&p->queued);
+  pthread_mutex_unlock (&p->lock);
+
+  for (i = 0; i < p->n_threads; ++i)
+    if (!pthread_equal (p->threads[i], pthread_self ()))
+      pthread_join (p->threads[i], NULL);
+
+  tvi_free (p->threads);
+  tvi_free (p->jobs);
+  p->n_threads = 0;
+  pthread_cond_destroy (&p->idle);
+  pthread_cond_destroy (&p->queued);
+  pthread_mutex_destroy (&p->lock);
+}
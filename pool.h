@@ -0,0 +1,58 @@
+/*
+ * tvi - TV series Information
+ *
+ * Copyright (C) 2014  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __TVI_POOL_H__
+#define __TVI_POOL_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "tvi.h"
+
+struct pool_job
+{
+  void (*run) (void *);
+  void *data;
+};
+
+/* Fixed set of worker threads taking jobs off a queue in the order they
+   were added. A pool without threads runs every job right away, in the
+   thread that adds it. */
+struct pool
+{
+  int n_threads;
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t queued; /* a job was added, or the pool is stopping */
+  pthread_cond_t idle;   /* the queue ran dry and no job is running */
+  struct pool_job *jobs; /* ring of SIZE jobs, N of them from HEAD on */
+  size_t head;
+  size_t n;
+  size_t size;
+  int running;           /* jobs being run */
+  bool stopping;
+};
+
+void pool_init (struct pool *p, int n_threads);
+void pool_add (struct pool *p, void (*run) (void *), void *data);
+void pool_wait (struct pool *p);
+void pool_free (struct pool *p);
+
+#endif /* __TVI_POOL_H__ */
@@ -0,0 +1,206 @@
+/*
+ * tvi - TV series Information
+ *
+ * Copyright (C) 2014  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "scan.h"
+#include "utils.h"
+
+void
+scanner_init (struct scanner *s, const char *const *patterns, int n)
+{
+  int i;
+  int c;
+  unsigned int n_states;
+  unsigned int head;
+  unsigned int tail;
+  unsigned int u;
+  unsigned int v;
+  unsigned int *fail;
+  unsigned int *queue;
+  const unsigned char *p;
+
+  if (n > SCAN_PATTERNS_MAX)
+    n = SCAN_PATTERNS_MAX;
+  s->n_patterns = n;
+
+  n_states = 1;
+  for (i = 0; i < n; ++i)
+  {
+    s->length[i] = strlen (patterns[i]);
+    n_states += s->length[i];
+  }
+  s->next = tvi_malloc (n_states * sizeof (*s->next));
+  s->hits = tvi_newa (uint8_t, n_states);
+  memset (s->next, 0, n_states * sizeof (*s->next));
+  memset (s->hits, 0, n_states);
+
+  /* the trie of the patterns; no state leads back to the root (0) yet, so
+     0 stands for no transition */
+  memset (s->is_start, 0, sizeof (s->is_start));
+  s->n_starts = 0;
+  for (i = 0, n_states = 1; i < n; ++i)
+  {
+    p = (const unsigned char *) patterns[i];
+    if (!s->is_start[*p])
+    {
+      s->is_start[*p] = true;
+      if (s->n_starts < SCAN_STARTS_MAX)
+        s->starts[s->n_starts] = *p;
+      s->n_starts++;
+    }
+    for (u = 0; *p; u = s->next[u][*p++])
+      if (!s->next[u][*p])
+        s->next[u][*p] = n_states++;
+    s->hits[u] |= 1 << i;
+  }
+  if (s->n_starts > SCAN_STARTS_MAX)
+    s->n_starts = 0;
+
+  /* fill in the missing transitions breadth first from those of the
+     longest proper suffix that is in the trie */
+  fail = tvi_newa (unsigned int, n_states);
+  queue = tvi_newa (unsigned int, n_states);
+  head = tail = 0;
+  for (c = 0; c < 256; ++c)
+  {
+    v = s->next[0][c];
+    if (v)
+    {
+      fail[v] = 0;
+      queue[tail++] = v;
+    }
+  }
+  while (head < tail)
+  {
+    u = queue[head++];
+    for (c = 0; c < 256; ++c)
+    {
+      v = s->next[u][c];
+      if (v)
+      {
+        fail[v] = s->next[fail[u]][c];
+        s->hits[v] |= s->hits[fail[v]];
+        queue[tail++] = v;
+      }
+      else
+        s->next[u][c] = s->next[fail[u]][c];
+    }
+  }
+  tvi_free (fail);
+  tvi_free (queue);
+}
+
+void
+scanner_free (struct scanner *s)
+{
+  tvi_free (s->next);
+  tvi_free (s->hits);
+}
+
+/* Returns the offset of the first byte from I on in T (which ends at N)
+   that a pattern starts with, or N. */
+static size_t
+skip_to_start (const struct scanner *s,
+               const unsigned char *t,
+               size_t i,
+               size_t n)
+{
+#ifdef __SSE2__
+  int mask;
+  __m128i b;
+  __m128i v0;
+  __m128i v1;
+  __m128i v2;
+  __m128i v3;
+
+  if (s->n_starts > 0)
+  {
+    /* unused slots repeat the first byte */
+    v0 = _mm_set1_epi8 ((char) s->starts[0]);
+    v1 = _mm_set1_epi8 ((char) s->starts[s->n_starts > 1 ? 1 : 0]);
+    v2 = _mm_set1_epi8 ((char) s->starts[s->n_starts > 2 ? 2 : 0]);
+    v3 = _mm_set1_epi8 ((char) s->starts[s->n_starts > 3 ? 3 : 0]);
+    for (; i + 16 <= n; i += 16)
+    {
+      b = _mm_loadu_si128 ((const __m128i *) (t + i));
+      mask = _mm_movemask_epi8 (
+               _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (b, v0),
+                                           _mm_cmpeq_epi8 (b, v1)),
+                             _mm_or_si128 (_mm_cmpeq_epi8 (b, v2),
+                                           _mm_cmpeq_epi8 (b, v3))));
+      if (mask)
+        return i + __builtin_ctz (mask);
+    }
+  }
+#endif
+  for (; i < n && !s->is_start[t[i]]; ++i)
+    ;
+  return i;
+}
+
+/* Scans T (which ends at N) on from where C stopped. Returns the number of
+   the next pattern found, which ends just before C->offset, or -1 once
+   all of T has been scanned. */
+int
+scanner_next (const struct scanner *s,
+              struct scan_cursor *c,
+              const char *text,
+              size_t n)
+{
+  int id;
+  size_t i;
+  unsigned int state;
+  const unsigned char *t;
+
+  if (!c->hits)
+  {
+    t = (const unsigned char *) text;
+    state = c->state;
+    for (i = c->offset; i < n; )
+    {
+      if (state == 0)
+      {
+        i = skip_to_start (s, t, i, n);
+        if (i == n)
+          break;
+      }
+      state = s->next[state][t[i++]];
+      if (s->hits[state])
+      {
+        c->hits = s->hits[state];
+        break;
+      }
+    }
+    c->state = state;
+    c->offset = i;
+    if (!c->hits)
+      return -1;
+  }
+
+  for (id = 0; !(c->hits & (1 << id)); ++id)
+    ;
+  c->hits &= ~(1 << id);
+  return id;
+}
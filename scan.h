@@ -0,0 +1,65 @@
+/*
+ * tvi - TV series Information
+ *
+ * Copyright (C) 2014  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __TVI_SCAN_H__
+#define __TVI_SCAN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tvi.h"
+
+#define SCAN_PATTERNS_MAX 8
+#define SCAN_STARTS_MAX   4 /* first bytes looked for a block at a time */
+
+#define SCAN_CURSOR_INIT {0, 0, 0}
+
+/* Aho-Corasick automaton finding any number of patterns in one pass over
+   a text. It is turned into a full transition table, so every byte costs
+   a single lookup. While no match is under way, runs of bytes no pattern
+   starts with are skipped 16 at a time. */
+struct scanner
+{
+  int n_patterns;
+  size_t length[SCAN_PATTERNS_MAX];
+  uint16_t (*next)[256]; /* next state for each state and byte */
+  uint8_t *hits;         /* patterns ending in each state, one bit each */
+  int n_starts;          /* 0 if there are too many to look for in blocks */
+  unsigned char starts[SCAN_STARTS_MAX];
+  bool is_start[256];
+};
+
+/* where a scan stopped, so it can go on over text that is still to
+   arrive */
+struct scan_cursor
+{
+  unsigned int state;
+  unsigned int hits;   /* patterns ending at OFFSET not returned yet */
+  size_t offset;       /* of the next byte to scan */
+};
+
+void scanner_init (struct scanner *s, const char *const *patterns, int n);
+void scanner_free (struct scanner *s);
+int scanner_next (const struct scanner *s,
+                  struct scan_cursor *c,
+                  const char *text,
+                  size_t n);
+
+#endif /* __TVI_SCAN_H__ */
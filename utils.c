@@ -159,7 +159,7 @@ critical_factorization (const unsigned char *needle,
 
   while (j + k < n_needle)
   {
-    a = __tolower (needle[j + 1]);
+    a = __tolower (needle[j + k]);
     b = __tolower (needle[max_suffix_rev + k]);
     if (b < a)
     {
@@ -349,8 +349,8 @@ two_way_long_needle (const unsigned char *haystack,
   return NULL;
 }
 
-char *
-tvi_strcasestr (const char *haystack_start, const char *needle_start)
+static char *
+strcasestr_scalar (const char *haystack_start, const char *needle_start)
 {
   const char *haystack = haystack_start;
   const char *needle = needle_start;
@@ -393,6 +393,204 @@ tvi_strcasestr (const char *haystack_start, const char *needle_start)
 #undef __LONG_NEEDLE_THRESHOLD
 /* }}} strcasestr algorithm */
 
+/* Vectorized strcasestr: every block of the haystack is folded to lower
+   case and compared with the first and the last byte of the needle at
+   once, and only the positions where both match are compared in full.
+   Only ASCII letters are folded, the same as tolower() in the C locale
+   tvi runs in. The tail of the haystack is copied to a zero-padded
+   buffer so it can be searched the same way without reading past the
+   end; zeros never match the last byte of the needle. */
+#if defined (__GNUC__) && defined (__SSE2__)
+# define HAVE_SIMD_STRCASESTR 1
+# include <immintrin.h>
+
+# define SIMD_NEEDLE_MAX 64   /* longer needles use the scalar search */
+# define SIMD_TAIL_SIZE  128  /* > 32 + SIMD_NEEDLE_MAX - 1 */
+
+static inline unsigned char
+ascii_tolower (unsigned char c)
+{
+  return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+static bool
+ascii_caseeq (const unsigned char *s1, const unsigned char *s2, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; ++i)
+    if (ascii_tolower (s1[i]) != ascii_tolower (s2[i]))
+      return false;
+  return true;
+}
+
+/* Copies the last N bytes of H to TAIL, zero-padded to SIMD_TAIL_SIZE. */
+static const unsigned char *
+simd_tail (unsigned char *tail, const unsigned char *h, size_t n)
+{
+  memcpy (tail, h, n);
+  memset (tail + n, 0, SIMD_TAIL_SIZE - n);
+  return tail;
+}
+
+static inline __m128i
+fold_sse2 (__m128i x)
+{
+  __m128i t;
+
+  t = _mm_sub_epi8 (x, _mm_set1_epi8 ('A'));
+  t = _mm_cmpeq_epi8 (_mm_min_epu8 (t, _mm_set1_epi8 (25)), t);
+  return _mm_or_si128 (x, _mm_and_si128 (t, _mm_set1_epi8 (0x20)));
+}
+
+/* Returns the offset of the first match in H (of length N) that starts
+   before offset STOP, or SIZE_MAX. The blocks only reach as far as they
+   fit in H; *NEXT is set to the first offset they did not get to. */
+static size_t
+search_sse2 (const unsigned char *h,
+             size_t n,
+             size_t stop,
+             const unsigned char *needle,
+             size_t m,
+             size_t *next)
+{
+  int bit;
+  unsigned int mask;
+  size_t i;
+  __m128i first;
+  __m128i last;
+
+  first = _mm_set1_epi8 ((char) ascii_tolower (needle[0]));
+  last = _mm_set1_epi8 ((char) ascii_tolower (needle[m - 1]));
+  for (i = 0; i < stop && i + m - 1 + 16 <= n; i += 16)
+  {
+    mask = _mm_movemask_epi8 (_mm_and_si128 (
+      _mm_cmpeq_epi8 (fold_sse2 (_mm_loadu_si128 ((const __m128i *)
+                                                  (h + i))), first),
+      _mm_cmpeq_epi8 (fold_sse2 (_mm_loadu_si128 ((const __m128i *)
+                                                  (h + i + m - 1))), last)));
+    while (mask)
+    {
+      bit = __builtin_ctz (mask);
+      if (i + bit < stop && ascii_caseeq (h + i + bit + 1, needle + 1, m - 1))
+        return i + bit;
+      mask &= mask - 1;
+    }
+  }
+  *next = i;
+  return SIZE_MAX;
+}
+
+__attribute__ ((target ("avx2")))
+static inline __m256i
+fold_avx2 (__m256i x)
+{
+  __m256i t;
+
+  t = _mm256_sub_epi8 (x, _mm256_set1_epi8 ('A'));
+  t = _mm256_cmpeq_epi8 (_mm256_min_epu8 (t, _mm256_set1_epi8 (25)), t);
+  return _mm256_or_si256 (x, _mm256_and_si256 (t, _mm256_set1_epi8 (0x20)));
+}
+
+__attribute__ ((target ("avx2")))
+static size_t
+search_avx2 (const unsigned char *h,
+             size_t n,
+             size_t stop,
+             const unsigned char *needle,
+             size_t m,
+             size_t *next)
+{
+  int bit;
+  unsigned int mask;
+  size_t i;
+  __m256i first;
+  __m256i last;
+
+  first = _mm256_set1_epi8 ((char) ascii_tolower (needle[0]));
+  last = _mm256_set1_epi8 ((char) ascii_tolower (needle[m - 1]));
+  for (i = 0; i < stop && i + m - 1 + 32 <= n; i += 32)
+  {
+    mask = (unsigned int) _mm256_movemask_epi8 (_mm256_and_si256 (
+      _mm256_cmpeq_epi8 (fold_avx2 (_mm256_loadu_si256 ((const __m256i *)
+                                                        (h + i))), first),
+      _mm256_cmpeq_epi8 (fold_avx2 (_mm256_loadu_si256 ((const __m256i *)
+                                                        (h + i + m - 1))),
+                         last)));
+    while (mask)
+    {
+      bit = __builtin_ctz (mask);
+      if (i + bit < stop && ascii_caseeq (h + i + bit + 1, needle + 1, m - 1))
+        return i + bit;
+      mask &= mask - 1;
+    }
+  }
+  *next = i;
+  return SIZE_MAX;
+}
+
+typedef size_t (*search_fn) (const unsigned char *,
+                             size_t,
+                             size_t,
+                             const unsigned char *,
+                             size_t,
+                             size_t *);
+
+static search_fn
+simd_search (void)
+{
+  static search_fn search = NULL;
+
+  if (!search)
+  {
+    __builtin_cpu_init ();
+    search = __builtin_cpu_supports ("avx2") ? search_avx2 : search_sse2;
+  }
+  return search;
+}
+
+static char *
+strcasestr_simd (const char *haystack, const char *needle, search_fn search)
+{
+  size_t i;
+  size_t m;
+  size_t n;
+  size_t r;
+  size_t stop;
+  const unsigned char *h;
+  unsigned char tail[SIMD_TAIL_SIZE];
+
+  m = strlen (needle);
+  n = strlen (haystack);
+  if (m > n)
+    return NULL;
+  h = (const unsigned char *) haystack;
+  stop = n - m + 1; /* number of places a match can start at */
+
+  r = search (h, n, stop, (const unsigned char *) needle, m, &i);
+  if (r != SIZE_MAX)
+    return (char *) haystack + r;
+  if (i >= stop)
+    return NULL;
+
+  /* fewer places are left than a block holds, so the rest of the haystack
+     is shorter than a block plus the needle */
+  r = search (simd_tail (tail, h + i, n - i), SIMD_TAIL_SIZE, stop - i,
+              (const unsigned char *) needle, m, &stop);
+  return (r != SIZE_MAX) ? (char *) haystack + i + r : NULL;
+}
+#endif
+
+char *
+tvi_strcasestr (const char *haystack, const char *needle)
+{
+#ifdef HAVE_SIMD_STRCASESTR
+  if (*needle && strlen (needle) <= SIMD_NEEDLE_MAX)
+    return strcasestr_simd (haystack, needle, simd_search ());
+#endif
+  return strcasestr_scalar (haystack, needle);
+}
+
 void *
 tvi_malloc (size_t n)
 {
@@ -433,6 +631,188 @@ tvi_strdup (const char *s, ssize_t n)
   return (char *) memcpy (p, s, len - 1);
 }
 
+/* Makes room for N more bytes (plus the terminating NUL) in B. The
+   allocation at least doubles each time it has to grow, so appending
+   many small chunks costs amortized constant time per byte. */
+void
+tvi_buffer_reserve (struct tvi_buffer *b, size_t n)
+{
+  size_t size;
+
+  if (b->buffer && b->n + n < b->size)
+    return;
+
+  size = b->size ? b->size : TVI_BUFFER_MIN;
+  while (b->n + n >= size)
+    size *= 2;
+  b->buffer = tvi_renewa (char, b->buffer, size);
+  b->buffer[b->n] = '\0';
+  b->size = size;
+}
+
+void
+tvi_buffer_append (struct tvi_buffer *b, const char *s, size_t n)
+{
+  tvi_buffer_reserve (b, n);
+  memcpy (b->buffer + b->n, s, n);
+  b->n += n;
+  b->buffer[b->n] = '\0';
+}
+
+/* Empties B but keeps its memory for reuse. */
+void
+tvi_buffer_clear (struct tvi_buffer *b)
+{
+  b->n = 0;
+  if (b->buffer)
+    *b->buffer = '\0';
+}
+
+void
+tvi_buffer_free (struct tvi_buffer *b)
+{
+  tvi_free (b->buffer);
+  b->n = 0;
+  b->size = 0;
+}
+
+/* Returns room for N bytes at the top of A, which stays free until
+   tvi_arena_commit() takes some of it. */
+char *
+tvi_arena_reserve (struct tvi_arena *a, size_t n)
+{
+  size_t size;
+  struct tvi_arena_chunk *c;
+
+  if (a->head && a->head->size - a->head->n >= n)
+    return a->head->data + a->head->n;
+
+  size = (n > TVI_ARENA_CHUNK) ? n : TVI_ARENA_CHUNK;
+  c = tvi_malloc (sizeof (*c) + size);
+  c->next = a->head;
+  c->n = 0;
+  c->size = size;
+  a->head = c;
+  return c->data;
+}
+
+/* Makes room at the top of A for MORE bytes after the N bytes at P, which
+   were written to room tvi_arena_reserve() (or this) returned; P may be
+   NULL if N is 0. Returns where the N bytes are now, which is somewhere
+   else if they had to be moved to a new chunk. */
+char *
+tvi_arena_extend (struct tvi_arena *a, char *p, size_t n, size_t more)
+{
+  char *q;
+
+  if (p && a->head->size - a->head->n >= n + more)
+    return p;
+  q = tvi_arena_reserve (a, (n + more > 2 * n) ? n + more : 2 * n);
+  if (n > 0)
+    memcpy (q, p, n);
+  return q;
+}
+
+/* Takes the first N bytes of the room tvi_arena_reserve() returned. */
+char *
+tvi_arena_commit (struct tvi_arena *a, size_t n)
+{
+  char *p;
+
+  p = a->head->data + a->head->n;
+  a->head->n += n;
+  return p;
+}
+
+char *
+tvi_arena_strdup (struct tvi_arena *a, const char *s, ssize_t n)
+{
+  char *p;
+
+  if (n < 0)
+    n = strlen (s);
+  p = tvi_arena_reserve (a, n + 1);
+  memcpy (p, s, n);
+  p[n] = '\0';
+  return tvi_arena_commit (a, n + 1);
+}
+
+/* Returns N zeroed bytes from the arena A for an array of records. A block
+   bigger than a quarter of a chunk gets a chunk of its own, put behind the
+   head so that the room left in the head is not given up for it. Nothing
+   reserved with tvi_arena_reserve() may be pending. */
+void *
+tvi_arena_alloc (struct tvi_arena *a, size_t n)
+{
+  size_t pad;
+  char *p;
+  struct tvi_arena_chunk *c;
+
+  if (a->head && n > TVI_ARENA_CHUNK / 4)
+  {
+    c = tvi_malloc (sizeof (*c) + n + TVI_ARENA_ALIGN - 1);
+    c->size = n + TVI_ARENA_ALIGN - 1;
+    c->n = c->size;
+    c->next = a->head->next;
+    a->head->next = c;
+    p = c->data + (-(uintptr_t) c->data & (TVI_ARENA_ALIGN - 1));
+  }
+  else
+  {
+    p = tvi_arena_reserve (a, n + TVI_ARENA_ALIGN - 1);
+    pad = -(uintptr_t) p & (TVI_ARENA_ALIGN - 1);
+    p = tvi_arena_commit (a, pad + n) + pad;
+  }
+  memset (p, 0, n);
+  return p;
+}
+
+/* Copies the N bytes at S to the arena A and returns a view of the copy. */
+struct tvi_str
+tvi_arena_str (struct tvi_arena *a, const char *s, size_t n)
+{
+  struct tvi_str v;
+
+  v.s = tvi_arena_strdup (a, s, n);
+  v.n = n;
+  return v;
+}
+
+/* Moves the strings of arena B to A, which leaves B empty. */
+void
+tvi_arena_merge (struct tvi_arena *a, struct tvi_arena *b)
+{
+  struct tvi_arena_chunk *c;
+
+  if (!b->head)
+    return;
+  if (!a->head)
+  {
+    a->head = b->head;
+    b->head = NULL;
+    return;
+  }
+  /* A goes on taking strings from its head chunk */
+  for (c = b->head; c->next; c = c->next)
+    ;
+  c->next = a->head->next;
+  a->head->next = b->head;
+  b->head = NULL;
+}
+
+void
+tvi_arena_free (struct tvi_arena *a)
+{
+  struct tvi_arena_chunk *c;
+
+  while (a->head)
+  {
+    c = a->head;
+    a->head = c->next;
+    free (c);
+  }
+}
+
 void
 tvi_replace_c (char *s, char c1, char c2)
 {
@@ -443,14 +823,17 @@ tvi_replace_c (char *s, char c1, char c2)
       *p = c2;
 }
 
-void
-tvi_strip_trailing_space (char *s)
+/* Returns the number of characters in UTF-8 string S, which is the number
+   of columns it takes up for all the text tvi prints. */
+size_t
+tvi_utf8_width (const char *s)
 {
   size_t n;
 
-  n = strlen (s) - 1;
-  while (s[n] == ' ')
-    s[n--] = '\0';
+  for (n = 0; *s; ++s)
+    if ((*s & 0xc0) != 0x80)
+      n++;
+  return n;
 }
 
 void
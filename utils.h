@@ -30,9 +30,21 @@
 #define TVI_BUFMAX             256
 #define TVI_MILLIS_PER_SECOND 1000
 
+#define TVI_BUFFER_MIN        4096 /* smallest allocation of a tvi_buffer */
+#define TVI_BUFFER_INIT       {0, 0, NULL}
+#define TVI_ARENA_CHUNK       65536 /* usual size of a tvi_arena chunk */
+#define TVI_ARENA_INIT        {NULL}
+#define TVI_ARENA_ALIGN       16    /* of blocks from tvi_arena_alloc() */
+#define TVI_STR_INIT          {"", 0}
+
+#define __tvi_stringify(x) #x
+#define TVI_STRINGIFY(x)   __tvi_stringify (x)
+
 #define tvi_new(t)          ((t *) tvi_malloc (sizeof (t)))
 #define tvi_newa(t, n)      ((t *) tvi_malloc ((n) * sizeof (t)))
 #define tvi_renewa(t, p, n) ((t *) tvi_realloc (p, (n) * sizeof (t)))
+#define tvi_arena_newa(a, t, n) \
+  ((t *) tvi_arena_alloc ((a), (n) * sizeof (t)))
 #define tvi_free(p) \
   do \
   { \
@@ -47,6 +59,37 @@
     (((end_timeval.tv_sec - start_timeval.tv_sec) * TVI_MILLIS_PER_SECOND) + \
      ((end_timeval.tv_usec - start_timeval.tv_usec) / TVI_MILLIS_PER_SECOND))
 
+/* growable byte buffer, always kept NUL-terminated once allocated */
+struct tvi_buffer
+{
+  size_t n;     /* bytes in use, not counting the terminating NUL */
+  size_t size;  /* bytes allocated */
+  char *buffer;
+};
+
+struct tvi_arena_chunk
+{
+  struct tvi_arena_chunk *next;
+  size_t n;     /* bytes handed out */
+  size_t size;  /* bytes in DATA */
+  char data[];
+};
+
+/* bump allocator for strings (and records) that all live as long as each
+   other; they are freed together with tvi_arena_free() */
+struct tvi_arena
+{
+  struct tvi_arena_chunk *head; /* chunk strings are taken from */
+};
+
+/* N bytes of text at S, which are owned by someone else (usually an
+   arena); S[N] is always a NUL, so S can be printed as it is */
+struct tvi_str
+{
+  const char *s;
+  size_t n;
+};
+
 #ifdef TVI_DEBUG
 # undef __TVI_FUNCTION__
 # if defined (__GNUC__)
@@ -85,8 +128,20 @@ char *tvi_strcasestr (const char *haystack, const char *needle);
 void *tvi_malloc (size_t n);
 void *tvi_realloc (void *o, size_t n);
 char *tvi_strdup (const char *s, ssize_t n);
+void tvi_buffer_reserve (struct tvi_buffer *b, size_t n);
+void tvi_buffer_append (struct tvi_buffer *b, const char *s, size_t n);
+void tvi_buffer_clear (struct tvi_buffer *b);
+void tvi_buffer_free (struct tvi_buffer *b);
+char *tvi_arena_reserve (struct tvi_arena *a, size_t n);
+char *tvi_arena_commit (struct tvi_arena *a, size_t n);
+char *tvi_arena_extend (struct tvi_arena *a, char *p, size_t n, size_t more);
+char *tvi_arena_strdup (struct tvi_arena *a, const char *s, ssize_t n);
+void *tvi_arena_alloc (struct tvi_arena *a, size_t n);
+struct tvi_str tvi_arena_str (struct tvi_arena *a, const char *s, size_t n);
+void tvi_arena_merge (struct tvi_arena *a, struct tvi_arena *b);
+void tvi_arena_free (struct tvi_arena *a);
 void tvi_replace_c (char *s, char c1, char c2);
-void tvi_strip_trailing_space (char *s);
+size_t tvi_utf8_width (const char *s);
 void tvi_gettimeofday (struct timeval *t);
 int tvi_console_width (void);
 